@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser-util.h"
+#include "alloc.h"
+
+lpool lpools[LPOOL_COUNT];
+long lwords_large_live = 0;
+long lalloc_sys_calls = 0;
+
+void lalloc_init(void) {
+    lpools[LPOOL_LVAL].name = "lval";
+    lpools[LPOOL_LVAL].size = sizeof(lval);
+    lpools[LPOOL_LENV].name = "lenv";
+    lpools[LPOOL_LENV].size = sizeof(lenv);
+
+    static char* names[] = {
+        "cells1", "cells2", "cells4", "cells8", "cells16", "cells32", "cells64"
+    };
+    for (int i = 0; i < LPOOL_COUNT - LPOOL_CELLS; i++) {
+        lpools[LPOOL_CELLS + i].name = names[i];
+        lpools[LPOOL_CELLS + i].size = sizeof(void*) << i;
+    }
+}
+
+void* lpool_alloc(int p) {
+    lpool* pool = &lpools[p];
+    if (!pool->size) { lalloc_init(); }
+
+    pool->allocs++;
+    pool->live++;
+    if (pool->live > pool->peak) { pool->peak = pool->live; }
+
+#ifdef LISPY_SYSTEM_MALLOC
+    lalloc_sys_calls++;
+    return malloc(pool->size);
+#else
+    /* reuse a freed object */
+    if (pool->free) {
+        void* x = pool->free;
+        pool->free = *(void**)x;
+        return x;
+    }
+
+    /* carve from the current slab, allocating a new one when spent */
+    if (pool->chunk_left == 0) {
+        lalloc_sys_calls++;
+        pool->chunk = malloc((size_t)pool->size * LPOOL_CHUNK);
+        pool->chunk_left = LPOOL_CHUNK;
+    }
+    void* x = pool->chunk;
+    pool->chunk += pool->size;
+    pool->chunk_left--;
+    return x;
+#endif
+}
+
+void lpool_free(int p, void* ptr) {
+    lpool* pool = &lpools[p];
+    pool->live--;
+
+#ifdef LISPY_SYSTEM_MALLOC
+    free(ptr);
+#else
+    *(void**)ptr = pool->free;
+    pool->free = ptr;
+#endif
+}
+
+/* pool for a block of n words, or -1 if it is too large */
+int lwords_pool(int n) {
+    if (n > LWORDS_MAX) { return -1; }
+    int p = LPOOL_CELLS;
+    for (int c = 1; c < n; c *= 2) { p++; }
+    return p;
+}
+
+/* block of at least n pointer sized words, *cap set to the real size */
+void* lwords_alloc(int n, int* cap) {
+    int p = lwords_pool(n);
+    if (p < 0) {
+        lalloc_sys_calls++;
+        lwords_large_live++;
+        *cap = n;
+        return malloc(sizeof(void*) * n);
+    }
+    *cap = 1 << (p - LPOOL_CELLS);
+    return lpool_alloc(p);
+}
+
+/* release a block of cap words from lwords_alloc */
+void lwords_free(void* ptr, int cap) {
+    int p = lwords_pool(cap);
+    if (p < 0) {
+        lwords_large_live--;
+        free(ptr);
+        return;
+    }
+    lpool_free(p, ptr);
+}
@@ -0,0 +1,48 @@
+/* size class pools for lval, lenv and cell arrays
+
+   build with -DLISPY_SYSTEM_MALLOC to route every request straight to
+   malloc/free (for ASan or valgrind), stats are kept either way */
+
+/* objects carved from each slab chunk */
+#define LPOOL_CHUNK 256
+
+/* largest pooled block, in pointer sized words (classes are powers of 2) */
+#define LWORDS_MAX 64
+
+enum {
+    LPOOL_LVAL, LPOOL_LENV,
+    LPOOL_CELLS, /* 1 word, then 2, 4 ... LWORDS_MAX */
+    LPOOL_COUNT = LPOOL_CELLS + 7
+};
+
+typedef struct lpool {
+    char* name;
+    int size;
+
+    /* free list, threaded through the freed objects */
+    void* free;
+
+    /* slab being carved */
+    char* chunk;
+    int chunk_left;
+
+    /* stats */
+    long live;
+    long peak;
+    long allocs;
+} lpool;
+
+extern lpool lpools[LPOOL_COUNT];
+
+/* word blocks too big for a pool */
+extern long lwords_large_live;
+
+/* calls made to the system allocator */
+extern long lalloc_sys_calls;
+
+void lalloc_init(void);
+void* lpool_alloc(int p);
+void lpool_free(int p, void* ptr);
+int lwords_pool(int n);
+void* lwords_alloc(int n, int* cap);
+void lwords_free(void* p, int cap);
@@ -0,0 +1,11 @@
+#!/bin/sh
+# write the large list inputs for bench/run into a directory (default
+# bench/): a 1M element (def {big} {...}) of distinct numbers, of small
+# numbers and of symbols, and an empty one to subtract as the base line.
+dir=${1:-bench}
+n=1000000
+
+awk -v n=$n 'BEGIN { printf "(def {big} {"; for (i = 0; i < n; i++) printf "%s%d", i ? " " : "", i; print "})" }' > "$dir/big-num.lispy"
+awk -v n=$n 'BEGIN { printf "(def {big} {"; for (i = 0; i < n; i++) printf "%s%d", i ? " " : "", i % 100; print "})" }' > "$dir/big-small.lispy"
+awk -v n=$n 'BEGIN { printf "(def {big} {"; for (i = 0; i < n; i++) printf "%ss%d", i ? " " : "", i % 100; print "})" }' > "$dir/big-sym.lispy"
+echo "(def {big} {})" > "$dir/big-none.lispy"
@@ -0,0 +1,11 @@
+#!/bin/sh
+# write bench/requests.lispy (or the file given): 40000 top level forms
+# that each run a small request, map/filter/sum over 60 items
+out=${1:-bench/requests.lispy}
+
+{
+    printf '(fun {req n} {sum (map (\\ {x} {* x n}) (filter (\\ {x} {> x 10}) {'
+    awk 'BEGIN { for (i = 0; i < 60; i++) printf "%s%d", i ? " " : "", i }'
+    echo '}))})'
+    awk 'BEGIN { for (i = 0; i < 40000; i++) printf "(req %d)\n", i % 7 }'
+} > "$out"
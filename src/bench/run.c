@@ -0,0 +1,71 @@
+/* benchmark driver: runs a lispy binary on each file given, n times, and
+   prints the best wall time and the peak resident set size seen.
+
+   gcc -O2 bench/run.c -o bench/run
+   bench/run [-n runs] ./lispy bench/lookup.lispy ... */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* run lispy on file once, returns 0 on success */
+static int run_once(char* lispy, char* file, double* secs, long* rss_kb) {
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pid_t pid = fork();
+    if (pid < 0) { return -1; }
+    if (pid == 0) {
+        int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        execl(lispy, lispy, file, (char*)NULL);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0) { return -1; }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    *secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    *rss_kb = ru.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    int runs = 5;
+    int i = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        runs = atoi(argv[2]);
+        i = 3;
+    }
+    if (argc - i < 2 || runs < 1) {
+        fprintf(stderr, "usage: %s [-n runs] lispy file.lispy...\n", argv[0]);
+        return 1;
+    }
+
+    char* lispy = argv[i++];
+    for (; i < argc; i++) {
+        double best = 0;
+        long peak = 0;
+        for (int r = 0; r < runs; r++) {
+            double secs;
+            long rss;
+            if (run_once(lispy, argv[i], &secs, &rss) != 0) {
+                fprintf(stderr, "%s: failed\n", argv[i]);
+                return 1;
+            }
+            if (r == 0 || secs < best) { best = secs; }
+            if (rss > peak) { peak = rss; }
+        }
+        printf("%-28s %8.3fs %9ld KB\n", argv[i], best, peak);
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "parser-util.h"
+#include "bignum.h"
+
+/* n zero limbs, sign 0 */
+lbig* lbig_new(int n) {
+    lbig* b = calloc(1, sizeof(lbig) + sizeof(uint32_t) * n);
+    b->n = n;
+    return b;
+}
+
+/* drop zero limbs from the top */
+lbig* lbig_trim(lbig* b) {
+    while (b->n && !b->d[b->n - 1]) { b->n--; }
+    if (!b->n) { b->sign = 0; }
+    return b;
+}
+
+lbig* lbig_copy(lbig* b) {
+    size_t size = sizeof(lbig) + sizeof(uint32_t) * b->n;
+    lbig* x = malloc(size);
+    memcpy(x, b, size);
+    return x;
+}
+
+lbig* lbig_long(long x) {
+    /* via unsigned so LONG_MIN negates */
+    uint64_t u = x < 0 ? -(uint64_t)x : (uint64_t)x;
+    lbig* b = lbig_new(2);
+    b->d[0] = (uint32_t)u;
+    b->d[1] = (uint32_t)(u >> 32);
+    b->sign = x < 0 ? -1 : 1;
+    return lbig_trim(b);
+}
+
+/* true and *x set if b fits a long */
+int lbig_fits(lbig* b, long* x) {
+    if (b->n > 2) { return 0; }
+    uint64_t u = 0;
+    if (b->n > 0) { u = b->d[0]; }
+    if (b->n > 1) { u |= (uint64_t)b->d[1] << 32; }
+
+    if (b->sign >= 0) {
+        if (u > LONG_MAX) { return 0; }
+        *x = (long)u;
+    } else {
+        if (u > (uint64_t)LONG_MAX + 1) { return 0; }
+        *x = -(long)(u - 1) - 1;
+    }
+    return 1;
+}
+
+/* compare magnitudes */
+int lbig_ucmp(lbig* a, lbig* b) {
+    if (a->n != b->n) { return a->n < b->n ? -1 : 1; }
+    for (int i = a->n - 1; i >= 0; i--) {
+        if (a->d[i] != b->d[i]) { return a->d[i] < b->d[i] ? -1 : 1; }
+    }
+    return 0;
+}
+
+int lbig_cmp(lbig* a, lbig* b) {
+    if (a->sign != b->sign) { return a->sign < b->sign ? -1 : 1; }
+    return a->sign * lbig_ucmp(a, b);
+}
+
+/* |a| + |b| */
+lbig* lbig_uadd(lbig* a, lbig* b) {
+    if (a->n < b->n) { lbig* t = a; a = b; b = t; }
+    lbig* r = lbig_new(a->n + 1);
+    uint64_t c = 0;
+    for (int i = 0; i < a->n; i++) {
+        c += (uint64_t)a->d[i] + (i < b->n ? b->d[i] : 0);
+        r->d[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    r->d[a->n] = (uint32_t)c;
+    r->sign = 1;
+    return lbig_trim(r);
+}
+
+/* |a| - |b| where |a| >= |b| */
+lbig* lbig_usub(lbig* a, lbig* b) {
+    lbig* r = lbig_new(a->n);
+    uint64_t borrow = 0;
+    for (int i = 0; i < a->n; i++) {
+        uint64_t t = (uint64_t)a->d[i] - (i < b->n ? b->d[i] : 0) - borrow;
+        r->d[i] = (uint32_t)t;
+        borrow = t >> 63;
+    }
+    r->sign = 1;
+    return lbig_trim(r);
+}
+
+/* a + b, taking b's sign to be bsign */
+lbig* lbig_addsign(lbig* a, lbig* b, int bsign) {
+    lbig* r;
+    if (!bsign) { return lbig_copy(a); }
+    if (!a->sign) {
+        r = lbig_copy(b);
+        r->sign = bsign;
+        return r;
+    }
+    if (a->sign == bsign) {
+        r = lbig_uadd(a, b);
+        r->sign = bsign;
+        return r;
+    }
+
+    int c = lbig_ucmp(a, b);
+    if (c == 0) { return lbig_new(0); }
+    if (c > 0) {
+        r = lbig_usub(a, b);
+        r->sign = a->sign;
+    } else {
+        r = lbig_usub(b, a);
+        r->sign = bsign;
+    }
+    return r;
+}
+
+lbig* lbig_add(lbig* a, lbig* b) {
+    return lbig_addsign(a, b, b->sign);
+}
+
+lbig* lbig_sub(lbig* a, lbig* b) {
+    return lbig_addsign(a, b, -b->sign);
+}
+
+lbig* lbig_mul(lbig* a, lbig* b) {
+    lbig* r = lbig_new(a->n + b->n);
+    for (int i = 0; i < a->n; i++) {
+        uint64_t c = 0;
+        for (int j = 0; j < b->n; j++) {
+            c += (uint64_t)a->d[i] * b->d[j] + r->d[i + j];
+            r->d[i + j] = (uint32_t)c;
+            c >>= 32;
+        }
+        r->d[i + b->n] = (uint32_t)c;
+    }
+    r->sign = a->sign * b->sign;
+    return lbig_trim(r);
+}
+
+/* a / b truncated towards zero, b not zero */
+lbig* lbig_div(lbig* a, lbig* b) {
+    if (lbig_ucmp(a, b) < 0) { return lbig_new(0); }
+
+    int n = b->n;
+    int m = a->n - n;
+    lbig* q = lbig_new(m + 1);
+    q->sign = a->sign * b->sign;
+
+    /* one limb divisor, short division */
+    if (n == 1) {
+        uint64_t r = 0;
+        for (int i = a->n - 1; i >= 0; i--) {
+            uint64_t cur = (r << 32) | a->d[i];
+            q->d[i] = (uint32_t)(cur / b->d[0]);
+            r = cur % b->d[0];
+        }
+        return lbig_trim(q);
+    }
+
+    /* knuth's algorithm d, on copies shifted so the divisor's top limb
+       has its high bit set and each estimate is off by at most 2 */
+    int s = __builtin_clz(b->d[n - 1]);
+    uint32_t* u = malloc(sizeof(uint32_t) * (a->n + 1));
+    uint32_t* v = malloc(sizeof(uint32_t) * n);
+    for (int i = n - 1; i > 0; i--) {
+        v[i] = (b->d[i] << s) | (uint32_t)((uint64_t)b->d[i - 1] >> (32 - s));
+    }
+    v[0] = b->d[0] << s;
+    u[a->n] = (uint32_t)((uint64_t)a->d[a->n - 1] >> (32 - s));
+    for (int i = a->n - 1; i > 0; i--) {
+        u[i] = (a->d[i] << s) | (uint32_t)((uint64_t)a->d[i - 1] >> (32 - s));
+    }
+    u[0] = a->d[0] << s;
+
+    for (int j = m; j >= 0; j--) {
+        /* estimate from the top two limbs, corrected by the third */
+        uint64_t top = ((uint64_t)u[j + n] << 32) | u[j + n - 1];
+        uint64_t qhat = top / v[n - 1];
+        uint64_t rhat = top % v[n - 1];
+        while (qhat >> 32 || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])) {
+            qhat--;
+            rhat += v[n - 1];
+            if (rhat >> 32) { break; }
+        }
+
+        /* u -= qhat * v at limb j */
+        uint64_t carry = 0;
+        int64_t borrow = 0;
+        for (int i = 0; i < n; i++) {
+            uint64_t p = qhat * v[i] + carry;
+            carry = p >> 32;
+            int64_t t = (int64_t)u[i + j] - (int64_t)(p & 0xffffffff) - borrow;
+            u[i + j] = (uint32_t)t;
+            borrow = t < 0;
+        }
+        int64_t t = (int64_t)u[j + n] - (int64_t)carry - borrow;
+        u[j + n] = (uint32_t)t;
+
+        /* estimate was one too big, add v back */
+        if (t < 0) {
+            qhat--;
+            uint64_t c = 0;
+            for (int i = 0; i < n; i++) {
+                c += (uint64_t)u[i + j] + v[i];
+                u[i + j] = (uint32_t)c;
+                c >>= 32;
+            }
+            u[j + n] += (uint32_t)c;
+        }
+        q->d[j] = (uint32_t)qhat;
+    }
+
+    free(u);
+    free(v);
+    return lbig_trim(q);
+}
+
+double lbig_double(lbig* b) {
+    double r = 0;
+    for (int i = b->n - 1; i >= 0; i--) { r = r * 4294967296.0 + b->d[i]; }
+    return b->sign < 0 ? -r : r;
+}
+
+/* the n chars at s, digits with an optional leading '-' */
+lbig* lbig_read(char* s, int n) {
+    int neg = (n && s[0] == '-');
+    /* 9 digits never need more than a limb each */
+    lbig* b = lbig_new(n / 9 + 2);
+    int used = 0;
+
+    for (int i = neg; i < n; ) {
+        /* next 9 digits at a time: b = b * 10^k + chunk */
+        uint64_t chunk = 0;
+        uint64_t mul = 1;
+        for (int k = 0; k < 9 && i < n; k++, i++) {
+            chunk = chunk * 10 + (s[i] - '0');
+            mul *= 10;
+        }
+        uint64_t c = chunk;
+        for (int k = 0; k < used; k++) {
+            c += (uint64_t)b->d[k] * mul;
+            b->d[k] = (uint32_t)c;
+            c >>= 32;
+        }
+        if (c) { b->d[used++] = (uint32_t)c; }
+    }
+
+    b->n = used;
+    b->sign = neg ? -1 : 1;
+    return lbig_trim(b);
+}
+
+/* decimal digits of b, malloced */
+char* lbig_str(lbig* b) {
+    /* a limb is at most 10 digits */
+    int cap = b->n * 10 + 2;
+    char* s = malloc(cap + 1);
+    char* p = s + cap;
+    *p = '\0';
+
+    /* groups of 9 digits off the bottom, dividing a copy by 10^9 */
+    uint32_t* t = malloc(sizeof(uint32_t) * (b->n + 1));
+    memcpy(t, b->d, sizeof(uint32_t) * b->n);
+    int tn = b->n;
+    while (tn) {
+        uint64_t r = 0;
+        for (int i = tn - 1; i >= 0; i--) {
+            uint64_t cur = (r << 32) | t[i];
+            t[i] = (uint32_t)(cur / 1000000000);
+            r = cur % 1000000000;
+        }
+        while (tn && !t[tn - 1]) { tn--; }
+
+        /* zero padded except for the top group */
+        for (int k = 0; k < 9; k++) {
+            *--p = '0' + r % 10;
+            r /= 10;
+            if (!tn && !r) { break; }
+        }
+    }
+    free(t);
+
+    if (p == s + cap) { *--p = '0'; }
+    if (b->sign < 0) { *--p = '-'; }
+    memmove(s, p, s + cap - p + 1);
+    return s;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include <stdint.h>
+
+/* arbitrary precision integers, for integer results past a long
+
+   the magnitude is in base 2^32 limbs, least significant first, with
+   no zero limbs at the top; sign is -1, 0 or 1. results are new
+   bignums, arguments are left alone. values only keep a bignum when it
+   does not fit a long (see lval_big) */
+
+struct lbig {
+    int sign;
+    int n;
+    uint32_t d[];
+};
+
+lbig* lbig_new(int n);
+lbig* lbig_trim(lbig* b);
+lbig* lbig_copy(lbig* b);
+lbig* lbig_long(long x);
+int lbig_fits(lbig* b, long* x);
+int lbig_cmp(lbig* a, lbig* b);
+lbig* lbig_add(lbig* a, lbig* b);
+lbig* lbig_sub(lbig* a, lbig* b);
+lbig* lbig_mul(lbig* a, lbig* b);
+lbig* lbig_div(lbig* a, lbig* b);
+double lbig_double(lbig* b);
+lbig* lbig_read(char* s, int n);
+char* lbig_str(lbig* b);
\ No newline at end of file
@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser-util.h"
+#include "vm.h"
+#include "image.h"
+#include "gc.h"
+#include "vector.h"
+
+int lgc_enabled = 0;
+lgc_stats lgc = { .threshold = LGC_MIN };
+
+/* every live env, each knowing its slot */
+lenv** lgc_envs = NULL;
+int lgc_nenvs = 0;
+int lgc_cap = 0;
+
+/* objects reachable from the tracked envs, and the references between
+   them; node i's edges are edges[first[i]] to edges[first[i + 1]] */
+typedef struct lgc_graph {
+    lptrmap index;
+    void** ptrs;
+    char* kinds;
+    long* refs;
+    long* first;
+    int count;
+    int cap;
+    int* edges;
+    long nedges;
+    long ecap;
+} lgc_graph;
+
+void lgc_track(lenv* e) {
+    if (lgc_nenvs == lgc_cap) {
+        lgc_cap = lgc_cap ? lgc_cap * 2 : 256;
+        lgc_envs = realloc(lgc_envs, sizeof(lenv*) * lgc_cap);
+    }
+    e->gc_slot = lgc_nenvs;
+    lgc_envs[lgc_nenvs++] = e;
+    lgc.made++;
+}
+
+void lgc_untrack(lenv* e) {
+    /* last env takes over the slot */
+    lenv* last = lgc_envs[--lgc_nenvs];
+    lgc_envs[e->gc_slot] = last;
+    last->gc_slot = e->gc_slot;
+    e->gc_slot = -1;
+}
+
+/* index of p in g, adding it if new */
+int lgc_node(lgc_graph* g, void* p, int kind) {
+    int i = lptrmap_get(&g->index, p);
+    if (i >= 0) { return i; }
+
+    if (g->count == g->cap) {
+        g->cap = g->cap ? g->cap * 2 : 1024;
+        g->ptrs = realloc(g->ptrs, sizeof(void*) * g->cap);
+        g->kinds = realloc(g->kinds, g->cap);
+        g->refs = realloc(g->refs, sizeof(long) * g->cap);
+        g->first = realloc(g->first, sizeof(long) * (g->cap + 1));
+    }
+    i = g->count++;
+    g->ptrs[i] = p;
+    g->kinds[i] = kind;
+    lptrmap_put(&g->index, p, i);
+    return i;
+}
+
+void lgc_edge(lgc_graph* g, void* p, int kind) {
+    int i = lgc_node(g, p, kind);
+    if (g->nedges == g->ecap) {
+        g->ecap = g->ecap ? g->ecap * 2 : 4096;
+        g->edges = realloc(g->edges, sizeof(int) * g->ecap);
+    }
+    g->edges[g->nedges++] = i;
+}
+
+/* only lambdas, lists, maps, vectors, sequences, caches and folds can
+   lead back to an env */
+void lgc_val_edge(lgc_graph* g, lval* v) {
+    if ((v->type == LVAL_FUN && !v->builtin) || v->type == LVAL_MAP
+        || v->type == LVAL_VEC || v->type == LVAL_SEQ || v->type == LVAL_MEMO
+        || v->type == LVAL_FOLD
+        || v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) {
+        lgc_edge(g, v, LGC_VAL);
+    }
+}
+
+/* add edges for the references node i holds */
+void lgc_scan(lgc_graph* g, int i) {
+    void* p = g->ptrs[i];
+    switch (g->kinds[i]) {
+        case LGC_ENV: {
+            lenv* e = p;
+            for (int j = 0; j < e->cap; j++) {
+                if (e->syms[j]) { lgc_val_edge(g, e->vals[j]); }
+            }
+            for (int j = e->old_pos; j < e->old_cap; j++) {
+                if (e->old_syms[j]) { lgc_val_edge(g, e->old_vals[j]); }
+            }
+            if (e->lex) { lgc_edge(g, e->lex, LGC_ENV); }
+        }
+        break;
+        case LGC_VAL: {
+            lval* v = p;
+            if (v->type == LVAL_FUN) {
+                lgc_edge(g, v->env, LGC_ENV);
+                lgc_val_edge(g, v->formals);
+                lgc_val_edge(g, v->body);
+            } else if (v->type == LVAL_MAP) {
+                ltable* t = v->table;
+                for (int j = 0; j < t->used; j++) {
+                    if (t->keys[j]) { lgc_val_edge(g, t->keys[j]); lgc_val_edge(g, t->vals[j]); }
+                }
+            } else if (v->type == LVAL_MEMO) {
+                /* shared by copies, a node of its own */
+                lgc_edge(g, v->memo, LGC_MEMO);
+            } else if (v->type == LVAL_FOLD) {
+                lgc_val_edge(g, v->value);
+                lgc_val_edge(g, v->expr);
+                lgc_val_edge(g, v->deps);
+            } else if (v->type == LVAL_SEQ) {
+                if (v->seq->fn) { lgc_val_edge(g, v->seq->fn); }
+                if (v->seq->src) { lgc_val_edge(g, v->seq->src); }
+            } else if (v->type == LVAL_VEC) {
+                if (v->root) { lgc_edge(g, v->root, LGC_VNODE); }
+                if (v->tail) { lgc_edge(g, v->tail, LGC_VNODE); }
+            } else {
+                if (v->buf) { lgc_edge(g, v->buf, LGC_CELLS); }
+                if (v->code) { lgc_edge(g, v->code, LGC_CODE); }
+            }
+        }
+        break;
+        case LGC_CELLS: {
+            lcells* b = p;
+            for (int j = b->lo; j < b->hi; j++) { lgc_val_edge(g, b->items[j]); }
+        }
+        break;
+        case LGC_CODE: {
+            lcode* c = p;
+            for (int j = 0; j < c->nconsts; j++) { lgc_val_edge(g, c->consts[j]); }
+        }
+        break;
+        case LGC_MEMO: {
+            lmemo* m = p;
+            ltable* t = m->table;
+            lgc_val_edge(g, m->fn);
+            for (int j = 0; j < t->used; j++) {
+                if (t->keys[j]) { lgc_val_edge(g, t->keys[j]); lgc_val_edge(g, t->vals[j]); }
+            }
+        }
+        break;
+        case LGC_VNODE: {
+            lvnode* n = p;
+            for (int j = 0; j < LVEC_WIDTH; j++) {
+                if (!n->slots[j]) { continue; }
+                if (n->leaf) {
+                    lgc_val_edge(g, n->slots[j]);
+                } else {
+                    lgc_edge(g, n->slots[j], LGC_VNODE);
+                }
+            }
+        }
+        break;
+    }
+}
+
+long lgc_refcount(void* p, int kind) {
+    switch (kind) {
+        case LGC_ENV: return ((lenv*)p)->refs;
+        case LGC_VAL: return ((lval*)p)->refs;
+        case LGC_CELLS: return ((lcells*)p)->refs;
+        case LGC_VNODE: return ((lvnode*)p)->refs;
+        case LGC_MEMO: return ((lmemo*)p)->refs;
+        default: return ((lcode*)p)->refs;
+    }
+}
+
+/* drop the bindings and captured env of e, collecting what they held */
+void lgc_clear(lenv* e, lval*** vals, long* nvals, long* cap) {
+    /* finish any pending resize so there is a single table to clear */
+    lenv_migrate(e, e->old_cap);
+
+    for (int j = 0; j < e->cap; j++) {
+        if (!e->syms[j]) { continue; }
+        if (*nvals == *cap) {
+            *cap = *cap ? *cap * 2 : 256;
+            *vals = realloc(*vals, sizeof(lval*) * *cap);
+        }
+        LSYM_BINDS(e->syms[j])--;
+        (*vals)[(*nvals)++] = e->vals[j];
+        e->syms[j] = NULL;
+    }
+    e->count = 0;
+}
+
+void lgc_collect(void) {
+    clock_t start = clock();
+    lgc_graph g;
+    memset(&g, 0, sizeof(g));
+
+    /* find everything reachable from the envs and the edges between it */
+    for (int i = 0; i < lgc_nenvs; i++) { lgc_node(&g, lgc_envs[i], LGC_ENV); }
+    for (int i = 0; i < g.count; i++) {
+        g.first[i] = g.nedges;
+        lgc_scan(&g, i);
+    }
+    if (g.cap) { g.first[g.count] = g.nedges; }
+
+    /* references from outside the graph */
+    for (int i = 0; i < g.count; i++) { g.refs[i] = lgc_refcount(g.ptrs[i], g.kinds[i]); }
+    for (long k = 0; k < g.nedges; k++) { g.refs[g.edges[k]]--; }
+
+    /* anything referenced from outside is live, and all it reaches */
+    char* live = calloc(g.count, 1);
+    int* stack = malloc(sizeof(int) * (g.count + 1));
+    int sp = 0;
+    for (int i = 0; i < g.count; i++) {
+        if (g.refs[i] > 0) { live[i] = 1; stack[sp++] = i; }
+    }
+    while (sp) {
+        int i = stack[--sp];
+        for (long k = g.first[i]; k < g.first[i + 1]; k++) {
+            int j = g.edges[k];
+            if (!live[j]) { live[j] = 1; stack[sp++] = j; }
+        }
+    }
+
+    /* hold the garbage envs while their bindings are dropped, so none is
+       freed while still being cleared */
+    int ndead = 0;
+    for (int i = 0; i < g.count; i++) {
+        if (!live[i] && g.kinds[i] == LGC_ENV) {
+            lenv* e = g.ptrs[i];
+            e->refs++;
+            stack[ndead++] = i;
+        }
+    }
+
+    lval** vals = NULL;
+    long nvals = 0;
+    long cap = 0;
+    lenv** lexes = malloc(sizeof(lenv*) * (ndead + 1));
+    int nlexes = 0;
+    for (int k = 0; k < ndead; k++) {
+        lenv* e = g.ptrs[stack[k]];
+        lgc_clear(e, &vals, &nvals, &cap);
+        if (e->lex) { lexes[nlexes++] = e->lex; e->lex = NULL; }
+    }
+    for (long k = 0; k < nvals; k++) { lval_del(vals[k]); }
+    for (int k = 0; k < nlexes; k++) { lenv_del(lexes[k]); }
+    for (int k = 0; k < ndead; k++) { lenv_del(g.ptrs[stack[k]]); }
+
+    lgc.collections++;
+    lgc.collected += ndead;
+    lgc.scanned = g.count;
+    lgc.made = 0;
+    lgc.pending = 0;
+    lgc.threshold = g.count > LGC_MIN ? g.count : LGC_MIN;
+
+    long pause = (long)((double)(clock() - start) * 1000000 / CLOCKS_PER_SEC);
+    lgc.pause_last = pause;
+    lgc.pause_total += pause;
+    if (pause > lgc.pause_max) { lgc.pause_max = pause; }
+
+    free(vals);
+    free(lexes);
+    free(live);
+    free(stack);
+    free(g.index.keys);
+    free(g.index.vals);
+    free(g.ptrs);
+    free(g.kinds);
+    free(g.refs);
+    free(g.first);
+    free(g.edges);
+}
+
+/* called between top level forms */
+void lgc_maybe(void) {
+    if (lgc_enabled && (lgc.pending || lgc.made >= lgc.threshold)) { lgc_collect(); }
+}
\ No newline at end of file
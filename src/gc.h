@@ -0,0 +1,48 @@
+/* cycle collector for the refcounted heap
+
+   refcounting frees everything but cycles, and every cycle goes through
+   an env: a closure bound in an env it captured, directly or inside a
+   list, map, vector, sequence or memo cache. with the collector enabled
+   every env is tracked. a collection walks the envs and the lambdas,
+   lists, maps, vectors, sequences, cell stores, vector nodes, caches and
+   code reachable from them, takes the references they hold on each
+   other off each refcount, and keeps whatever is still referenced from
+   outside (the global env, frames and stacks of running code, c
+   locals) along with everything reachable from it. the envs left over
+   are garbage; their bindings are dropped, which breaks the cycles so
+   refcounting frees the rest.
+
+   half evaluated expressions hold pointers they have handed on, so
+   collections only run between top level forms (see ltop_form), never
+   in a load nested in a form: once enough envs were made since the
+   last one, or when (gc) asked for one */
+
+#define LGC_MIN 65536
+
+enum { LGC_ENV, LGC_VAL, LGC_CELLS, LGC_CODE, LGC_VNODE, LGC_MEMO };
+
+typedef struct lgc_stats {
+    long collections;
+    /* envs made since the last collection, and how many trigger one */
+    long made;
+    long threshold;
+    /* set by (gc) */
+    int pending;
+    /* objects walked by the last collection, envs freed by all */
+    long scanned;
+    long collected;
+    /* processor time, microseconds */
+    long pause_last;
+    long pause_max;
+    long pause_total;
+} lgc_stats;
+
+/* track envs and collect cycles, otherwise cycles leak */
+extern int lgc_enabled;
+extern lgc_stats lgc;
+extern int lgc_nenvs;
+
+void lgc_track(lenv* e);
+void lgc_untrack(lenv* e);
+void lgc_maybe(void);
+void lgc_collect(void);
\ No newline at end of file
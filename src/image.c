@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "parser-util.h"
+#include "image.h"
+#include "vm.h"
+#include "bignum.h"
+#include "vector.h"
+#include "opt.h"
+
+/* index stored for key, or -1 */
+int lptrmap_get(lptrmap* t, void* key) {
+    if (!t->cap) { return -1; }
+    int i = lenv_hash(key) & (t->cap - 1);
+    while (t->keys[i]) {
+        if (t->keys[i] == key) { return t->vals[i]; }
+        i = (i + 1) & (t->cap - 1);
+    }
+    return -1;
+}
+
+void lptrmap_put(lptrmap* t, void* key, int val) {
+    /* grow and rehash at 3/4 load */
+    if ((t->count + 1) * 4 > t->cap * 3) {
+        lptrmap n = { NULL, NULL, 0, t->cap ? t->cap * 2 : 64 };
+        n.keys = calloc(n.cap, sizeof(void*));
+        n.vals = malloc(n.cap * sizeof(int));
+        for (int i = 0; i < t->cap; i++) {
+            if (t->keys[i]) { lptrmap_put(&n, t->keys[i], t->vals[i]); }
+        }
+        free(t->keys);
+        free(t->vals);
+        *t = n;
+    }
+
+    int i = lenv_hash(key) & (t->cap - 1);
+    while (t->keys[i]) { i = (i + 1) & (t->cap - 1); }
+    t->keys[i] = key;
+    t->vals[i] = val;
+    t->count++;
+}
+
+/* empty image to write to */
+limage limage_new(void) {
+    limage m;
+    memset(&m, 0, sizeof(m));
+    return m;
+}
+
+/* image to read from the len bytes at s */
+limage limage_over(unsigned char* s, long len) {
+    limage m = limage_new();
+    m.s = s;
+    m.len = len;
+    return m;
+}
+
+/* free the writer tables and reader refs, not the bytes */
+void limage_free(limage* m) {
+    free(m->syms.keys);
+    free(m->syms.vals);
+    free(m->envs.keys);
+    free(m->envs.vals);
+    free(m->symv);
+    for (int i = 0; i < m->nenvs; i++) { lenv_del(m->envv[i]); }
+    free(m->envv);
+}
+
+void limage_bytes(limage* m, char* s, long n) {
+    if (m->len + n > m->cap) {
+        while (m->len + n > m->cap) { m->cap = m->cap ? m->cap * 2 : 256; }
+        m->s = realloc(m->s, m->cap);
+    }
+    memcpy(m->s + m->len, s, n);
+    m->len += n;
+}
+
+void limage_byte(limage* m, int b) {
+    char c = b;
+    limage_bytes(m, &c, 1);
+}
+
+/* 7 bits a byte, high bit set on all but the last */
+void limage_varint(limage* m, uint64_t x) {
+    char buf[10];
+    int n = 0;
+    while (x >= 0x80) {
+        buf[n++] = (x & 0x7f) | 0x80;
+        x >>= 7;
+    }
+    buf[n++] = x;
+    limage_bytes(m, buf, n);
+}
+
+/* zigzag, so small negative numbers stay short */
+void limage_svarint(limage* m, long x) {
+    limage_varint(m, ((uint64_t)x << 1) ^ (uint64_t)((int64_t)x >> 63));
+}
+
+void limage_sym(limage* m, char* sym) {
+    int i = lptrmap_get(&m->syms, sym);
+    if (i >= 0) {
+        limage_byte(m, LTAG_SYMREF);
+        limage_varint(m, i);
+        return;
+    }
+
+    lptrmap_put(&m->syms, sym, m->syms.count);
+    long n = strlen(sym);
+    limage_byte(m, LTAG_SYM);
+    limage_varint(m, n);
+    limage_bytes(m, sym, n);
+}
+
+/* env of a lambda with the envs it captured, bindings in slot order */
+void limage_env(limage* m, lenv* e) {
+    if (!e) {
+        limage_byte(m, LTAG_NOENV);
+        return;
+    }
+
+    int i = lptrmap_get(&m->envs, e);
+    if (i >= 0) {
+        limage_byte(m, LTAG_ENVREF);
+        limage_varint(m, i);
+        return;
+    }
+
+    /* indexed before its contents, which may refer back to it */
+    lptrmap_put(&m->envs, e, m->envs.count);
+    limage_byte(m, LTAG_ENV);
+    limage_env(m, e->lex);
+
+    /* finish any pending resize so there is a single table to walk */
+    lenv_migrate(e, e->old_cap);
+    limage_varint(m, e->count);
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+        limage_sym(m, e->syms[i]);
+        limage_val(m, e->vals[i]);
+    }
+}
+
+void limage_val(limage* m, lval* v) {
+    switch (v->type) {
+        case LVAL_NUM:
+            limage_byte(m, LTAG_NUM);
+            limage_svarint(m, v->num);
+        break;
+        case LVAL_BIG:
+            limage_byte(m, LTAG_BIG);
+            limage_byte(m, v->big->sign < 0);
+            limage_varint(m, v->big->n);
+            for (int i = 0; i < v->big->n; i++) { limage_varint(m, v->big->d[i]); }
+        break;
+        case LVAL_DBL: {
+            uint64_t bits;
+            memcpy(&bits, &v->dbl, sizeof(bits));
+            limage_byte(m, LTAG_DBL);
+            for (int i = 0; i < 8; i++) { limage_byte(m, (bits >> (8 * i)) & 0xff); }
+        }
+        break;
+        case LVAL_ERR:
+        case LVAL_STR: {
+            char* s = v->type == LVAL_ERR ? v->err : v->str;
+            long n = strlen(s);
+            limage_byte(m, v->type == LVAL_ERR ? LTAG_ERR : LTAG_STR);
+            limage_varint(m, n);
+            limage_bytes(m, s, n);
+        }
+        break;
+        case LVAL_SYM: limage_sym(m, v->sym); break;
+        /* as written, folded again as it is loaded */
+        case LVAL_FOLD: limage_val(m, v->expr); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            v = lval_written(v);
+            limage_byte(m, v->type == LVAL_SEXPR ? LTAG_SEXPR : LTAG_QEXPR);
+            limage_varint(m, v->count);
+            for (int i = 0; i < v->count; i++) { limage_val(m, v->cell[i]); }
+        break;
+        case LVAL_MAP: {
+            ltable* t = v->table;
+            limage_byte(m, LTAG_MAP);
+            limage_varint(m, t->count);
+            for (int i = 0; i < t->used; i++) {
+                if (!t->keys[i]) { continue; }
+                limage_val(m, t->keys[i]);
+                limage_val(m, t->vals[i]);
+            }
+        }
+        break;
+        case LVAL_VEC:
+            limage_byte(m, LTAG_VEC);
+            limage_varint(m, v->end - v->lo);
+            for (int i = 0; i < v->end - v->lo; i++) { limage_val(m, lvec_nth(v, i)); }
+        break;
+        case LVAL_MEMO:
+            limage_byte(m, LTAG_MEMO);
+            limage_varint(m, v->memo->max);
+            limage_val(m, v->memo->fn);
+        break;
+        case LVAL_SEQ: {
+            lseq* s = v->seq;
+            limage_byte(m, LTAG_SEQ);
+            limage_byte(m, s->kind);
+            limage_svarint(m, s->from);
+            limage_svarint(m, s->to);
+            limage_svarint(m, s->step);
+            limage_byte(m, (s->open ? 1 : 0) | (s->fn ? 2 : 0) | (s->src ? 4 : 0));
+            if (s->fn) { limage_val(m, s->fn); }
+            if (s->src) { limage_val(m, s->src); }
+        }
+        break;
+        case LVAL_FUN:
+            if (v->builtin) {
+                limage_byte(m, LTAG_BUILTIN);
+                limage_sym(m, lbuiltin_name(v->builtin));
+            } else {
+                limage_byte(m, LTAG_LAMBDA);
+                limage_env(m, v->env);
+                limage_val(m, v->formals);
+                limage_val(m, v->body);
+            }
+        break;
+    }
+}
+
+void limage_header(limage* m, int kind) {
+    limage_bytes(m, LIMAGE_MAGIC, 4);
+    limage_byte(m, LIMAGE_VERSION);
+    limage_byte(m, kind);
+}
+
+/* the bindings of e that the builtins did not make */
+void limage_globals(limage* m, lenv* e) {
+    limage_header(m, LIMAGE_GLOBALS);
+
+    lenv_migrate(e, e->old_cap);
+    int count = 0;
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+        lval* v = e->vals[i];
+        if (v->type == LVAL_FUN && v->builtin && lbuiltin_name(v->builtin) == e->syms[i]) {
+            continue;
+        }
+        count++;
+    }
+
+    limage_varint(m, count);
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+        lval* v = e->vals[i];
+        if (v->type == LVAL_FUN && v->builtin && lbuiltin_name(v->builtin) == e->syms[i]) {
+            continue;
+        }
+        limage_sym(m, e->syms[i]);
+        limage_val(m, v);
+    }
+}
+
+int limage_rbyte(limage* m) {
+    if (m->pos >= m->len) {
+        m->bad = 1;
+        return -1;
+    }
+    return m->s[m->pos++];
+}
+
+uint64_t limage_rvarint(limage* m) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int b = limage_rbyte(m);
+        if (b < 0) { return 0; }
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) { return x; }
+    }
+    m->bad = 1;
+    return 0;
+}
+
+long limage_rsvarint(limage* m) {
+    uint64_t z = limage_rvarint(m);
+    return (long)(int64_t)((z >> 1) ^ -(z & 1));
+}
+
+/* length prefixed bytes, in place */
+char* limage_rbytes(limage* m, long* n) {
+    unsigned long len = limage_rvarint(m);
+    if (len > (unsigned long)(m->len - m->pos)) {
+        m->bad = 1;
+        *n = 0;
+        return NULL;
+    }
+    char* s = (char*)m->s + m->pos;
+    m->pos += len;
+    *n = len;
+    return s;
+}
+
+/* counts can't be more than the bytes left, each item takes one */
+long limage_rcount(limage* m) {
+    unsigned long n = limage_rvarint(m);
+    if (n > (unsigned long)(m->len - m->pos)) {
+        m->bad = 1;
+        return 0;
+    }
+    return n;
+}
+
+/* symbol after its tag has been read */
+lval* limage_rsym_tagged(limage* m, int tag) {
+    if (tag == LTAG_SYMREF) {
+        unsigned long i = limage_rvarint(m);
+        if (i >= (unsigned long)m->nsyms) {
+            m->bad = 1;
+            return NULL;
+        }
+        return m->symv[i];
+    }
+    if (tag != LTAG_SYM) {
+        m->bad = 1;
+        return NULL;
+    }
+
+    long n;
+    char* s = limage_rbytes(m, &n);
+    if (m->bad) { return NULL; }
+    lval* sym = lsym_intern_n(s, n);
+    /* doubling at powers of 2 */
+    if ((m->nsyms & (m->nsyms - 1)) == 0) {
+        m->symv = realloc(m->symv, sizeof(lval*) * (m->nsyms ? m->nsyms * 2 : 1));
+    }
+    m->symv[m->nsyms++] = sym;
+    return sym;
+}
+
+lval* limage_rsym(limage* m) {
+    return limage_rsym_tagged(m, limage_rbyte(m));
+}
+
+/* env with a reference for the caller, NULL for none or if bad */
+lenv* limage_renv(limage* m) {
+    int tag = limage_rbyte(m);
+    if (tag == LTAG_NOENV) { return NULL; }
+    if (tag == LTAG_ENVREF) {
+        unsigned long i = limage_rvarint(m);
+        if (i >= (unsigned long)m->nenvs) {
+            m->bad = 1;
+            return NULL;
+        }
+        m->envv[i]->refs++;
+        return m->envv[i];
+    }
+    if (tag != LTAG_ENV) {
+        m->bad = 1;
+        return NULL;
+    }
+
+    /* the image holds a reference while reading, see limage_free */
+    lenv* e = lenv_new();
+    if ((m->nenvs & (m->nenvs - 1)) == 0) {
+        m->envv = realloc(m->envv, sizeof(lenv*) * (m->nenvs ? m->nenvs * 2 : 1));
+    }
+    m->envv[m->nenvs++] = e;
+
+    e->lex = limage_renv(m);
+    long count = limage_rcount(m);
+    for (long i = 0; i < count && !m->bad; i++) {
+        lval* k = limage_rsym(m);
+        lval* v = limage_rval(m);
+        if (k && v) { lenv_put(e, k, v); }
+        if (v) { lval_del(v); }
+    }
+
+    e->refs++;
+    return e;
+}
+
+/* next value, NULL if bad */
+lval* limage_rval(limage* m) {
+    int tag = limage_rbyte(m);
+    lval* x = NULL;
+    long n;
+    char* s;
+
+    switch (tag) {
+        case LTAG_NUM:
+            x = lval_num(limage_rsvarint(m));
+        break;
+        case LTAG_BIG: {
+            int neg = limage_rbyte(m);
+            long count = limage_rcount(m);
+            lbig* b = lbig_new(count);
+            for (long i = 0; i < count; i++) {
+                uint64_t d = limage_rvarint(m);
+                if (d > 0xffffffff) { m->bad = 1; }
+                b->d[i] = d;
+            }
+            b->sign = neg ? -1 : 1;
+            lbig_trim(b);
+            if (m->bad) { free(b); } else { x = lval_big(b); }
+        }
+        break;
+        case LTAG_DBL: {
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; i++) {
+                bits |= (uint64_t)(limage_rbyte(m) & 0xff) << (8 * i);
+            }
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            if (!isfinite(d)) { m->bad = 1; }
+            if (!m->bad) { x = lval_dbl(d); }
+        }
+        break;
+        case LTAG_ERR:
+            s = limage_rbytes(m, &n);
+            if (!m->bad) { x = lval_err("%.*s", (int)n, s); }
+        break;
+        case LTAG_STR:
+            s = limage_rbytes(m, &n);
+            if (m->bad) { break; }
+            x = lval_new(LVAL_STR);
+            x->str = malloc(n + 1);
+            x->map = NULL;
+            memcpy(x->str, s, n);
+            x->str[n] = '\0';
+        break;
+        case LTAG_SEXPR:
+        case LTAG_QEXPR:
+            /* count is known, fill a store of that size */
+            n = limage_rcount(m);
+            x = lval_qexpr_cap(n);
+            if (tag == LTAG_SEXPR) { x->type = LVAL_SEXPR; }
+            for (long i = 0; i < n && !m->bad; i++) {
+                lval* y = limage_rval(m);
+                if (!y) { break; }
+                lval_add(x, y);
+            }
+        break;
+        case LTAG_MAP:
+            n = limage_rcount(m);
+            x = lval_map();
+            for (long i = 0; i < n && !m->bad; i++) {
+                lval* k = limage_rval(m);
+                if (!k) { break; }
+                lval* y = limage_rval(m);
+                if (!y) { lval_del(k); break; }
+                ltable_put(x->table, k, y);
+            }
+        break;
+        case LTAG_VEC:
+            n = limage_rcount(m);
+            x = lval_vec();
+            for (long i = 0; i < n && !m->bad; i++) {
+                lval* y = limage_rval(m);
+                if (!y) { break; }
+                x = lvec_push(x, y);
+            }
+        break;
+        case LTAG_MEMO: {
+            long max = limage_rvarint(m);
+            lval* fn = m->bad ? NULL : limage_rval(m);
+            if (!fn || fn->type != LVAL_FUN || max <= 0) {
+                if (fn) { lval_del(fn); }
+                m->bad = 1;
+                break;
+            }
+            x = lval_memo(fn, max);
+        }
+        break;
+        case LTAG_SEQ: {
+            int kind = limage_rbyte(m);
+            long nums[3];
+            for (int i = 0; i < 3; i++) { nums[i] = limage_rsvarint(m); }
+            int flags = limage_rbyte(m);
+            lval* fn = (flags & 2) && !m->bad ? limage_rval(m) : NULL;
+            lval* src = (flags & 4) && !m->bad ? limage_rval(m) : NULL;
+            /* only what the lazy builtins could have made */
+            int fun = kind == LSEQ_MAP || kind == LSEQ_FILTER;
+            int ok = kind >= LSEQ_RANGE && kind <= LSEQ_FORMS
+                && (fun ? fn && fn->type == LVAL_FUN : !fn)
+                && (kind == LSEQ_RANGE ? !src && nums[2] != 0
+                    : kind == LSEQ_FORMS ? src && src->type == LVAL_STR
+                    : src && lval_is_seqable(src));
+            if (!ok) { m->bad = 1; }
+            x = lval_seq(kind, fn, src);
+            x->seq->from = nums[0];
+            x->seq->to = nums[1];
+            x->seq->step = nums[2];
+            x->seq->open = flags & 1;
+        }
+        break;
+        case LTAG_SYM:
+        case LTAG_SYMREF:
+            x = limage_rsym_tagged(m, tag);
+        break;
+        case LTAG_BUILTIN: {
+            lval* name = limage_rsym(m);
+            lbuiltin f = name ? lbuiltin_find(name->sym) : NULL;
+            if (f) { x = lval_fun(f); } else { m->bad = 1; }
+        }
+        break;
+        case LTAG_LAMBDA: {
+            lenv* env = limage_renv(m);
+            lval* formals = limage_rval(m);
+            lval* body = limage_rval(m);
+            if (!env || !formals || !body || formals->type != LVAL_QEXPR
+                || body->type != LVAL_QEXPR) {
+                if (env) { lenv_del(env); }
+                if (formals) { lval_del(formals); }
+                if (body) { lval_del(body); }
+                m->bad = 1;
+                break;
+            }
+
+            /* as lval_lambda, with the env as it was */
+            x = lval_new(LVAL_FUN);
+            x->builtin = NULL;
+            x->env = env;
+            x->formals = formals;
+            x->body = (lopt_enabled && !env->lex) ? lopt_body(formals, body) : body;
+            if (lvm_enabled) { lcode_compile(env->lex, formals, x->body); }
+        }
+        break;
+        default: m->bad = 1;
+    }
+
+    if (m->bad && x) {
+        lval_del(x);
+        x = NULL;
+    }
+    return x;
+}
+
+/* skip the header if it is for an image of kind, else the error */
+lval* limage_check(limage* m, int kind) {
+    if (m->len < LIMAGE_HEADER || memcmp(m->s, LIMAGE_MAGIC, 4) != 0) {
+        return lval_err("Not a lispy image.");
+    }
+    if (m->s[4] != LIMAGE_VERSION || m->s[5] != kind) {
+        return lval_err("Image version %i kind %i, expected version %i kind %i.",
+            m->s[4], m->s[5], LIMAGE_VERSION, kind);
+    }
+    m->pos = LIMAGE_HEADER;
+    return NULL;
+}
+
+/* bind the globals in the image at s into e */
+lval* limage_load_globals(lenv* e, unsigned char* s, long len) {
+    limage m = limage_over(s, len);
+    lval* err = limage_check(&m, LIMAGE_GLOBALS);
+    if (err) { return err; }
+
+    long count = limage_rcount(&m);
+    for (long i = 0; i < count && !m.bad; i++) {
+        lval* k = limage_rsym(&m);
+        lval* v = limage_rval(&m);
+        if (k && v) { lenv_put(e, k, v); }
+        if (v) { lval_del(v); }
+    }
+
+    int bad = m.bad;
+    limage_free(&m);
+    if (bad) { return lval_err("Image is truncated or corrupt."); }
+    return lval_sexpr();
+}
+
+/* write the globals of e to path as the lstd_image array */
+int limage_dump_header(lenv* e, char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) { return 0; }
+
+    limage m = limage_new();
+    limage_globals(&m, e);
+
+    fprintf(f, "/* generated by lispy --dump-image from lib-std.lispy */\n");
+    fprintf(f, "unsigned char lstd_image[] = {");
+    for (long i = 0; i < m.len; i++) {
+        fprintf(f, "%s%d,", i % 16 ? " " : "\n    ", m.s[i]);
+    }
+    fprintf(f, "\n};\n");
+
+    free(m.s);
+    limage_free(&m);
+    return fclose(f) == 0;
+}
+
+/* the value in the image at s */
+lval* limage_load_value(unsigned char* s, long len) {
+    limage m = limage_over(s, len);
+    lval* x = limage_check(&m, LIMAGE_VALUE);
+    if (x) { return x; }
+
+    x = limage_rval(&m);
+    if (x && m.pos != m.len) {
+        lval_del(x);
+        x = NULL;
+    }
+    limage_free(&m);
+    return x ? x : lval_err("Image is truncated or corrupt.");
+}
@@ -0,0 +1,98 @@
+#include <stdint.h>
+
+/* binary images of values and of the global env
+
+   a value is a tag byte and its payload. numbers and lengths are
+   varints, numbers zigzagged so small negatives stay short. a symbol is
+   spelled out the first time it appears and referred to by index after
+   that; envs of lambdas likewise, so envs shared between closures (and
+   closures stored in the env they captured) come back shared.
+
+   an image file is LIMAGE_MAGIC, LIMAGE_VERSION and its kind. a
+   globals image then has the binding count and (symbol value) for each
+   binding, without the builtins bound under their own names; a value
+   image (serialize) has the one value */
+
+#define LIMAGE_MAGIC "LSPI"
+#define LIMAGE_VERSION 6
+#define LIMAGE_HEADER 6
+
+enum { LIMAGE_GLOBALS, LIMAGE_VALUE };
+
+enum {
+    LTAG_NUM,     /* zigzag varint */
+    LTAG_ERR,     /* len bytes */
+    LTAG_STR,     /* len bytes */
+    LTAG_SEXPR,   /* count values */
+    LTAG_QEXPR,   /* count values */
+    LTAG_SYM,     /* len bytes, takes the next symbol index */
+    LTAG_SYMREF,  /* index */
+    LTAG_BUILTIN, /* symbol it is registered under */
+    LTAG_LAMBDA,  /* env formals body */
+    LTAG_ENV,     /* lex count (symbol value)..., takes the next env index */
+    LTAG_ENVREF,  /* index */
+    LTAG_NOENV,
+    LTAG_BIG,     /* sign byte, count limbs as varints */
+    LTAG_DBL,     /* 8 bytes, least significant first */
+    LTAG_MAP,     /* count (key value)... */
+    LTAG_VEC,     /* count values */
+    LTAG_SEQ,     /* kind from to step open, then fn and src if set */
+    LTAG_MEMO     /* max fn, the cache starts empty */
+};
+
+/* open addressing map from pointers to indexes */
+typedef struct lptrmap {
+    void** keys;
+    int* vals;
+    int count;
+    int cap;
+} lptrmap;
+
+/* image being written or read */
+typedef struct limage {
+    unsigned char* s;
+    long len;
+    long cap;
+    long pos;
+
+    /* writing: index of each symbol and env written */
+    lptrmap syms;
+    lptrmap envs;
+
+    /* reading: symbols and envs by index */
+    lval** symv;
+    int nsyms;
+    lenv** envv;
+    int nenvs;
+
+    /* set when reading runs past the end or meets a bad tag */
+    int bad;
+} limage;
+
+limage limage_new(void);
+limage limage_over(unsigned char* s, long len);
+void limage_free(limage* m);
+int lptrmap_get(lptrmap* t, void* key);
+void lptrmap_put(lptrmap* t, void* key, int val);
+void limage_byte(limage* m, int b);
+void limage_varint(limage* m, uint64_t x);
+void limage_svarint(limage* m, long x);
+void limage_bytes(limage* m, char* s, long n);
+void limage_sym(limage* m, char* sym);
+void limage_env(limage* m, lenv* e);
+void limage_val(limage* m, lval* v);
+void limage_header(limage* m, int kind);
+void limage_globals(limage* m, lenv* e);
+int limage_rbyte(limage* m);
+uint64_t limage_rvarint(limage* m);
+long limage_rsvarint(limage* m);
+char* limage_rbytes(limage* m, long* n);
+long limage_rcount(limage* m);
+lval* limage_rsym_tagged(limage* m, int tag);
+lval* limage_rsym(limage* m);
+lenv* limage_renv(limage* m);
+lval* limage_rval(limage* m);
+lval* limage_check(limage* m, int kind);
+lval* limage_load_globals(lenv* e, unsigned char* s, long len);
+lval* limage_load_value(unsigned char* s, long len);
+int limage_dump_header(lenv* e, char* path);
@@ -1,17 +1,70 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "compat.h"
 #include "parser-util.h"
+#include "vm.h"
+#include "opt.h"
+#include "image.h"
+#include "gc.h"
+
+#ifdef LISPY_STD_IMAGE
+/* lstd_image, lib-std.lispy as loaded at build time (see Makefile) */
+#include "lib-std-image.h"
+#define LSTD_IMAGE_LEN sizeof(lstd_image)
+#else
+#define lstd_image NULL
+#define LSTD_IMAGE_LEN 0
+#endif
 
 int main(int argc, char** argv) {
+    /* --no-vm or LISPY_VM=0 tree walk everything, --no-opt or
+       LISPY_OPT=0 leave lambda bodies as written, --gc or LISPY_GC=1
+       collect cycles, --no-image loads the std lib source, --dump-image
+       writes the header for the build, other args are files */
+    char* vm = getenv("LISPY_VM");
+    if (vm && strcmp(vm, "0") == 0) { lvm_enabled = 0; }
+    char* opt = getenv("LISPY_OPT");
+    if (opt && strcmp(opt, "0") == 0) { lopt_enabled = 0; }
+    char* gc = getenv("LISPY_GC");
+    if (gc && strcmp(gc, "1") == 0) { lgc_enabled = 1; }
+
+    int image = 1;
+    char* dump = NULL;
+    int files = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-vm") == 0) { lvm_enabled = 0; }
+        else if (strcmp(argv[i], "--no-opt") == 0) { lopt_enabled = 0; }
+        else if (strcmp(argv[i], "--gc") == 0) { lgc_enabled = 1; }
+        else if (strcmp(argv[i], "--no-image") == 0) { image = 0; }
+        else if (strcmp(argv[i], "--dump-image") == 0 && i + 1 < argc) { dump = argv[++i]; }
+        else { argv[files++] = argv[i]; }
+    }
+    argc = files;
+
     lenv* e = lenv_new();
     lenv_add_builtins(e);
 
-    /* load standard library */
-    lval* std_lib_val = lval_add(lval_sexpr(), lval_str("lib-std.lispy"));
-    builtin_load(e, std_lib_val);
+    /* load standard library, from the built in image if there is one */
+    int loaded = 0;
+    if (image && !dump && LSTD_IMAGE_LEN) {
+        lval* x = limage_load_globals(e, lstd_image, LSTD_IMAGE_LEN);
+        if (x->type == LVAL_ERR) { lval_println(x); } else { loaded = 1; }
+        lval_del(x);
+    }
+    if (!loaded) {
+        lval* std_lib_val = lval_add(lval_sexpr(), lval_str("lib-std.lispy"));
+        lval_del(builtin_load(e, std_lib_val));
+    }
+
+    if (dump) {
+        int ok = limage_dump_header(e, dump);
+        if (!ok) { perror(dump); }
+        lenv_del(e);
+        return ok ? 0 : 1;
+    }
 
     /* repl */
     if (argc == 1) {        
@@ -23,13 +76,16 @@ int main(int argc, char** argv) {
             add_history(input);
 
             /* parse input */
-            int pos = 0;
-            lval* expr = lval_read_expr(input, &pos, '\0');
+            lreader r = lreader_new(input, strlen(input));
+            lval* expr = lval_read_expr(&r, '\0');
 
             /* eval and print */
+            ltop_form = 1;
             lval* x = lval_eval(e, expr);
             lval_println(x);
             lval_del(x);
+            lgc_maybe();
+            ltop_form = 0;
 
             // todo?
             free(input);
@@ -40,6 +96,12 @@ int main(int argc, char** argv) {
     if (argc >= 2) {
         /* for each file name */
         for (int i = 1; i < argc; i++) {
+            /* "-" reads the program from stdin */
+            if (strcmp(argv[i], "-") == 0) {
+                lval_del(lval_load(e, stdin));
+                continue;
+            }
+
             /* filename */
             lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
 
@@ -51,6 +113,8 @@ int main(int argc, char** argv) {
     }
 
     lenv_del(e);
+    /* cycles the global env was part of go too */
+    if (lgc_enabled) { lgc_collect(); }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser-util.h"
+#include "opt.h"
+
+int lopt_enabled = 1;
+int lopt_epoch = 0;
+
+/* formals of the lambdas being folded, which are never globals there */
+static char** lopt_names = NULL;
+static int lopt_nnames = 0;
+static int lopt_ncap = 0;
+
+/* folded expression, taking value, expr and deps, a q-expr of each
+   global read followed by the value it had */
+lval* lval_fold(lval* value, lval* expr, lval* deps) {
+    lval* v = lval_new(LVAL_FOLD);
+    v->value = value;
+    v->expr = expr;
+    v->deps = deps;
+    v->epoch = lopt_epoch;
+    return v;
+}
+
+/* global binding of sym, not a new reference; NULL if unbound */
+static lval* lopt_bound(char* sym) {
+    int old;
+    int i = lenv_find(lenv_global, sym, &old);
+    if (i < 0) { return NULL; }
+    return old ? lenv_global->old_vals[i] : lenv_global->vals[i];
+}
+
+/* true if v still stands for its expression */
+int lfold_valid(lval* v) {
+    lval* d = v->deps;
+    for (int i = 0; i < d->count; i += 2) {
+        if (LSYM_BINDS(d->cell[i]->sym) != 1) { return 0; }
+    }
+    if (v->epoch == lopt_epoch) { return 1; }
+    if (v->epoch < 0) { return 0; }
+
+    /* a global was redefined, for good if it is one of ours */
+    for (int i = 0; i < d->count; i += 2) {
+        if (lopt_bound(d->cell[i]->sym) != d->cell[i+1]) {
+            v->epoch = -1;
+            return 0;
+        }
+    }
+    v->epoch = lopt_epoch;
+    return 1;
+}
+
+static void lopt_name(char* sym) {
+    if (lopt_nnames == lopt_ncap) {
+        lopt_ncap = lopt_ncap ? lopt_ncap * 2 : 16;
+        lopt_names = realloc(lopt_names, sizeof(char*) * lopt_ncap);
+    }
+    lopt_names[lopt_nnames++] = sym;
+}
+
+/* global x names wherever the body is evaluated, not a new reference;
+   NULL if it may be something else */
+static lval* lopt_global(lval* x) {
+    if (x->type != LVAL_SYM || LSYM_BINDS(x->sym) != 1) { return NULL; }
+    for (int i = 0; i < lopt_nnames; i++) {
+        if (lopt_names[i] == x->sym) { return NULL; }
+    }
+    return lopt_bound(x->sym);
+}
+
+/* builtins whose result depends on nothing but their args */
+static int lopt_pure(lbuiltin f) {
+    return lmath_op(f) >= 0 || lord_op(f) >= 0
+        || f == builtin_eq || f == builtin_ne || f == builtin_list
+        || f == builtin_head || f == builtin_tail || f == builtin_join
+        || f == builtin_len;
+}
+
+/* true if x evaluates to itself and is never changed in place */
+static int lopt_data(lval* x) {
+    return x->type == LVAL_NUM || x->type == LVAL_BIG || x->type == LVAL_DBL
+        || x->type == LVAL_STR || x->type == LVAL_QEXPR;
+}
+
+/* add the reads in src to deps */
+static void lopt_deps(lval* deps, lval* src) {
+    for (int i = 0; i < src->count; i += 2) {
+        int found = 0;
+        for (int j = 0; j < deps->count; j += 2) {
+            if (deps->cell[j] == src->cell[i]) { found = 1; break; }
+        }
+        if (found) { continue; }
+        lval_add(deps, lval_ref(src->cell[i]));
+        lval_add(deps, lval_ref(src->cell[i+1]));
+    }
+}
+
+static lval* lopt_list(lval* x);
+
+/* x as code, folded: a new reference, to x itself if nothing folds */
+static lval* lopt_expr(lval* x) {
+    if (x->type == LVAL_SEXPR) { return lopt_list(x); }
+    if (x->type != LVAL_SYM) { return lval_ref(x); }
+
+    lval* g = lopt_global(x);
+    if (!g || !lopt_data(g)) { return lval_ref(x); }
+    lval* deps = lval_qexpr();
+    lval_add(deps, lval_ref(x));
+    lval_add(deps, lval_ref(g));
+    return lval_fold(lval_ref(g), lval_ref(x), deps);
+}
+
+/* list x evaluated as an s-expression, folded: a new reference, to x
+   itself if nothing folds. a call that folds whole is its fold node,
+   or a q-expr of just that when x is a q-expr (see lval_written) */
+static lval* lopt_list(lval* x) {
+    if (x->count == 0) { return lval_ref(x); }
+
+    lval* head = lopt_global(x->cell[0]);
+    lbuiltin f = (head && head->type == LVAL_FUN) ? head->builtin : NULL;
+    int lambda = (f == builtin_lambda || f == builtin_fun) && x->count == 3
+        && x->cell[1]->type == LVAL_QEXPR;
+
+    /* a nested lambda's formals hide globals in its body */
+    int names = lopt_nnames;
+    if (lambda) {
+        lval* formals = x->cell[1];
+        for (int i = 0; i < formals->count; i++) {
+            if (formals->cell[i]->type == LVAL_SYM) { lopt_name(formals->cell[i]->sym); }
+        }
+    }
+
+    /* new list from the first item that folded */
+    lval* y = NULL;
+    for (int i = 0; i < x->count; i++) {
+        lval* c = x->cell[i];
+        if (c->type != LVAL_QEXPR) {
+            c = lopt_expr(c);
+        } else if ((f == builtin_if && x->count == 4 && i >= 2) || (lambda && i == 2)) {
+            c = lopt_list(c);
+        } else {
+            c = lval_ref(c);
+        }
+        if (!y && c != x->cell[i]) {
+            y = lval_qexpr_cap(x->count);
+            y->type = x->type;
+            for (int j = 0; j < i; j++) { lval_add(y, lval_ref(x->cell[j])); }
+        }
+        if (y) { lval_add(y, c); } else { lval_del(c); }
+    }
+    lopt_nnames = names;
+    if (!y) { y = lval_ref(x); }
+
+    /* a pure builtin on constants is its result */
+    if (!f || !lopt_pure(f)) { return y; }
+    lval* deps = lval_qexpr();
+    lval_add(deps, lval_ref(x->cell[0]));
+    lval_add(deps, lval_ref(head));
+    lval* a = lval_sexpr();
+    for (int i = 1; i < y->count; i++) {
+        lval* c = y->cell[i];
+        if (c->type == LVAL_FOLD) {
+            lopt_deps(deps, c->deps);
+            c = c->value;
+        } else if (!lopt_data(c)) {
+            lval_del(a); lval_del(deps);
+            return y;
+        }
+        lval_add(a, lval_ref(c));
+    }
+
+    /* errors are left to happen when it runs */
+    lval* r = f(lenv_global, a);
+    if (r->type == LVAL_ERR) {
+        lval_del(r); lval_del(deps);
+        return y;
+    }
+
+    lval* v = lval_fold(r, y, deps);
+    if (x->type == LVAL_QEXPR) { v = lval_add(lval_qexpr(), v); }
+    return v;
+}
+
+/* body of a lambda with formals, folded; takes body */
+lval* lopt_body(lval* formals, lval* body) {
+    lopt_nnames = 0;
+    for (int i = 0; i < formals->count; i++) { lopt_name(formals->cell[i]->sym); }
+    lval* x = lopt_list(body);
+    lopt_nnames = 0;
+
+    lval_del(body);
+    return x;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+/* constant folding of lambda bodies, run as a lambda is defined
+
+   calls of pure builtins (math, comparisons, list building) on
+   constants are made once and replaced by their result, and names of
+   globals bound to plain data by their value. a folded expression
+   becomes a fold node holding the value, the expression it came from
+   and the globals it read. lookups search the caller's envs too, so the
+   value only stands while each of those globals is still bound as it
+   was and in no other env (LSYM_BINDS is 1); otherwise the expression
+   is evaluated as written, a q-expr as an s-expression. redefining a
+   global bumps lopt_epoch, which makes folds check their globals again
+
+   q-expr args are only folded where they are code: the branches of if
+   and the bodies of \ and fun. nested lambdas are folded with the one
+   around them, so lambdas made at run time are not folded again */
+
+/* fold lambda bodies as they are defined */
+extern int lopt_enabled;
+/* bumped when a global binding is replaced */
+extern int lopt_epoch;
+
+lval* lval_fold(lval* value, lval* expr, lval* deps);
+int lfold_valid(lval* v);
+lval* lopt_body(lval* formals, lval* body);
\ No newline at end of file
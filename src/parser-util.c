@@ -1,23 +1,83 @@
+/* fileno, mmap, madvise */
+#define _DEFAULT_SOURCE
+
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "parser-util.h"
+#include "alloc.h"
+#include "vm.h"
+#include "image.h"
+#include "gc.h"
+#include "bignum.h"
+#include "vector.h"
+#include "opt.h"
+
+/* lvals allocated so far, by type */
+long ltype_allocs[LVAL_TYPE_COUNT];
+
+/* pooled lval with a single reference */
+lval* lval_new(int type) {
+    lval* v = lpool_alloc(LPOOL_LVAL);
+    v->type = type;
+    v->refs = 1;
+    ltype_allocs[type]++;
+    return v;
+}
+
+/* shared nodes for small numbers, set up on first use */
+lval lnum_small[LNUM_SMALL_MAX - LNUM_SMALL_MIN];
 
 /* number type lval */
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    if (x >= LNUM_SMALL_MIN && x < LNUM_SMALL_MAX) {
+        lval* v = &lnum_small[x - LNUM_SMALL_MIN];
+        if (!v->refs) {
+            v->type = LVAL_NUM;
+            v->refs = LVAL_IMMORTAL;
+            v->num = x;
+        }
+        return v;
+    }
+
+    lval* v = lval_new(LVAL_NUM);
     v->num = x;
     return v;
 }
 
+/* integer value of b, which it takes; a fixnum if it fits */
+lval* lval_big(lbig* b) {
+    long x;
+    if (lbig_fits(b, &x)) {
+        free(b);
+        return lval_num(x);
+    }
+    lval* v = lval_new(LVAL_BIG);
+    v->big = b;
+    return v;
+}
+
+lval* lval_dbl(double x) {
+    lval* v = lval_new(LVAL_DBL);
+    v->dbl = x;
+    return v;
+}
+
 /* error type lval */
 lval* lval_err(char* fmt, ...) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_new(LVAL_ERR);
     
     /* crate and init a list */
     va_list va;
@@ -38,40 +98,149 @@ lval* lval_err(char* fmt, ...) {
     return v;
 }
 
-/* symbol type lval */
-lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
+/* symbol intern table, each distinct name has one shared lval */
+lval** lsym_tab = NULL;
+int lsym_cap = 0;
+int lsym_count = 0;
+
+/* interned "&" for varargs formals */
+char* lsym_amp = NULL;
+
+/* interned "if", which the vm compiles inline */
+char* lsym_if = NULL;
+
+/* FNV-1a hash of the n chars of a symbol name */
+unsigned long lsym_hash(char* s, int n) {
+    unsigned long h = 2166136261u;
+    for (int i = 0; i < n; i++) { h = (h ^ (unsigned char)s[i]) * 16777619u; }
+    return h;
+}
+
+/* canonical symbol for s, equal names give the same lval and name */
+lval* lsym_intern(char* s) {
+    return lsym_intern_n(s, strlen(s));
+}
+
+/* as lsym_intern for the n chars at s, which need no terminator */
+lval* lsym_intern_n(char* s, int n) {
+    /* grow and rehash at 3/4 load */
+    if ((lsym_count + 1) * 4 > lsym_cap * 3) {
+        int cap = lsym_cap ? lsym_cap * 2 : 256;
+        lval** tab = calloc(cap, sizeof(lval*));
+        for (int i = 0; i < lsym_cap; i++) {
+            if (!lsym_tab[i]) { continue; }
+            char* name = lsym_tab[i]->sym;
+            int j = lsym_hash(name, strlen(name)) & (cap - 1);
+            while (tab[j]) { j = (j + 1) & (cap - 1); }
+            tab[j] = lsym_tab[i];
+        }
+        free(lsym_tab);
+        lsym_tab = tab;
+        lsym_cap = cap;
+    }
+
+    int i = lsym_hash(s, n) & (lsym_cap - 1);
+    while (lsym_tab[i]) {
+        char* name = lsym_tab[i]->sym;
+        if (strncmp(name, s, n) == 0 && name[n] == '\0') { return lsym_tab[i]; }
+        i = (i + 1) & (lsym_cap - 1);
+    }
+
+    lval* v = lval_new(LVAL_SYM);
+    v->refs = LVAL_IMMORTAL;
+    /* name is prefixed by its binding count, see LSYM_BINDS */
+    long* name = malloc(sizeof(long) + n + 1);
+    name[0] = 0;
+    v->sym = (char*)(name + 1);
+    memcpy(v->sym, s, n);
+    v->sym[n] = '\0';
+    lsym_tab[i] = v;
+    lsym_count++;
+
+    if (!lsym_amp) {
+        lsym_amp = lsym_intern("&")->sym;
+        lsym_if = lsym_intern("if")->sym;
+    }
     return v;
 }
 
+/* symbol type lval, shared with every other use of the name */
+lval* lval_sym(char* s) {
+    return lsym_intern(s);
+}
+
 /* s-expression type lval */
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_new(LVAL_SEXPR);
     v->count = 0;
     v->cell = NULL;
+    v->buf = NULL;
+    v->code = NULL;
     return v;
 }
 
 /* q-expression type lval */
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_new(LVAL_QEXPR);
     v->count = 0;
     v->cell = NULL;
+    v->buf = NULL;
+    v->code = NULL;
     return v;
 }
 
+/* empty q-expression with room for n items */
+lval* lval_qexpr_cap(int n) {
+    lval* v = lval_qexpr();
+    if (n) {
+        v->buf = lcells_new(n);
+        v->cell = v->buf->items;
+    }
+    return v;
+}
+
+/* list v as written, the list a body folded whole came from (see
+   opt.h) */
+lval* lval_written(lval* v) {
+    if (v->type == LVAL_QEXPR && v->count == 1 && v->cell[0]->type == LVAL_FOLD
+        && v->cell[0]->expr->type == LVAL_QEXPR) {
+        return v->cell[0]->expr;
+    }
+    return v;
+}
+
+/* take another reference to v */
+lval* lval_ref(lval* v) {
+    v->refs++;
+    return v;
+}
+
+/* drop a reference to v, freeing it with the last one */
 void lval_del(lval* v) {
+    if (--v->refs > 0) { return; }
+
     switch (v->type)
     {
         case LVAL_NUM: break;
+        case LVAL_BIG: free(v->big); break;
+        case LVAL_DBL: break;
+        case LVAL_MAP: ltable_del(v->table); break;
+        case LVAL_VEC:
+            if (v->root) { lvnode_del(v->root); }
+            if (v->tail) { lvnode_del(v->tail); }
+        break;
+        case LVAL_SEQ: lseq_del(v->seq); break;
+        case LVAL_MEMO: lmemo_del(v->memo); break;
+        case LVAL_FOLD:
+            lval_del(v->value);
+            lval_del(v->expr);
+            lval_del(v->deps);
+        break;
         case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+        case LVAL_SYM: break;
+        case LVAL_STR:
+            if (v->map) { lmap_del(v->map); } else { free(v->str); }
+        break;
         case LVAL_FUN:
             if(!v->builtin) {
                 lenv_del(v->env);
@@ -81,63 +250,275 @@ void lval_del(lval* v) {
         break;
         case LVAL_QEXPR:
         case LVAL_SEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
-            }
-            free(v->cell);
+            if (v->buf) { lcells_del(v->buf); }
+            if (v->code) { lcode_del(v->code); }
         break;
     }
-    free(v);
+    lpool_free(LPOOL_LVAL, v);
+}
+
+/* cell store with room for at least n items */
+lcells* lcells_new(int n) {
+    int cap;
+    lcells* b = lwords_alloc(n + LCELLS_HEADER, &cap);
+    b->refs = 1;
+    b->cap = cap - LCELLS_HEADER;
+    b->lo = 0;
+    b->hi = 0;
+    return b;
+}
+
+void lcells_del(lcells* b) {
+    if (--b->refs > 0) { return; }
+    for (int i = b->lo; i < b->hi; i++) {
+        lval_del(b->items[i]);
+    }
+    lwords_free(b, b->cap + LCELLS_HEADER);
+}
+
+/* make v's cell store private to v and owning exactly its items */
+void lval_own_cells(lval* v) {
+    /* about to change, compiled code no longer matches */
+    if (v->code) { lcode_del(v->code); v->code = NULL; }
+
+    lcells* b = v->buf;
+    if (!b) { return; }
+
+    /* shared with other slices, copy our items out */
+    if (b->refs > 1) {
+        lcells* n = lcells_new(v->count);
+        for (int i = 0; i < v->count; i++) {
+            n->items[i] = lval_ref(v->cell[i]);
+        }
+        n->hi = v->count;
+        b->refs--;
+        v->buf = n;
+        v->cell = n->items;
+        return;
+    }
+
+    /* release items left outside our slice */
+    int lo = v->cell - b->items;
+    int hi = lo + v->count;
+    for (int i = b->lo; i < lo; i++) { lval_del(b->items[i]); }
+    for (int i = hi; i < b->hi; i++) { lval_del(b->items[i]); }
+    b->lo = lo;
+    b->hi = hi;
+}
+
+/* ensure room for front items before and back items after v's cells,
+   growing geometrically so repeated adds are amortized O(1) */
+void lval_reserve(lval* v, int front, int back) {
+    lval_own_cells(v);
+    lcells* b = v->buf;
+    if (b && b->lo >= front && b->cap - b->hi >= back) { return; }
+
+    /* new store twice the size, slack split towards the growing end */
+    int need = v->count + front + back;
+    lcells* n = lcells_new(need * 2);
+    int slack = n->cap - need;
+    int lo = front + (front ? (back ? slack / 2 : slack) : 0);
+
+    if (v->count) { memcpy(&n->items[lo], v->cell, sizeof(lval*) * v->count); }
+    n->lo = lo;
+    n->hi = lo + v->count;
+
+    /* items moved over, free the old store without releasing them */
+    if (b) { lwords_free(b, b->cap + LCELLS_HEADER); }
+    v->buf = n;
+    v->cell = &n->items[lo];
 }
 
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count-1] = x;
+    lval_reserve(v, 0, 1);
+    v->cell[v->count++] = x;
+    v->buf->hi++;
     return v;
 }
 
-void lval_expr_print(lval* v, char open, char close) {
-    putchar(open);    
-    
+/* buffered writer for stdout, flushed into stdio after each print and
+   set up on first use */
+lout lout_stdout = { NULL, 0, 0, NULL };
+
+lout* lout_std(void) {
+    if (!lout_stdout.f) { lout_stdout = lout_file(stdout); }
+    return &lout_stdout;
+}
+
+/* writer collecting a string, see lout_take */
+lout lout_string(void) {
+    lout o = { malloc(LOUT_CHUNK), 0, LOUT_CHUNK, NULL };
+    return o;
+}
+
+/* writer to f, buffered until lout_flush */
+lout lout_file(FILE* f) {
+    lout o = { malloc(LOUT_CHUNK), 0, LOUT_CHUNK, f };
+    return o;
+}
+
+void lout_flush(lout* o) {
+    if (o->f && o->len) { fwrite(o->s, 1, o->len, o->f); }
+    o->len = 0;
+}
+
+/* the collected string, the writer is spent */
+char* lout_take(lout* o) {
+    lout_char(o, '\0');
+    return realloc(o->s, o->len);
+}
+
+/* room for n more chars, flushing file writers before growing */
+void lout_reserve(lout* o, long n) {
+    if (o->len + n <= o->cap) { return; }
+    if (o->f) {
+        lout_flush(o);
+        if (n <= o->cap) { return; }
+    }
+    while (o->len + n > o->cap) { o->cap = o->cap ? o->cap * 2 : LOUT_CHUNK; }
+    o->s = realloc(o->s, o->cap);
+}
+
+void lout_write(lout* o, char* s, long n) {
+    /* too big to be worth buffering */
+    if (o->f && n > o->cap) {
+        lout_flush(o);
+        fwrite(s, 1, n, o->f);
+        return;
+    }
+    lout_reserve(o, n);
+    memcpy(o->s + o->len, s, n);
+    o->len += n;
+}
+
+void lout_char(lout* o, char c) {
+    lout_reserve(o, 1);
+    o->s[o->len++] = c;
+}
+
+void lout_cstr(lout* o, char* s) {
+    lout_write(o, s, strlen(s));
+}
+
+/* decimal digits of x, built from the end */
+void lout_num(lout* o, long x) {
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    /* via unsigned so LONG_MIN negates */
+    unsigned long u = x < 0 ? -(unsigned long)x : (unsigned long)x;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (x < 0) { *--p = '-'; }
+    lout_write(o, p, buf + sizeof(buf) - p);
+}
+
+void lout_dbl(lout* o, double x) {
+    /* fewest digits that read back as x */
+    char buf[32];
+    for (int p = 15; p <= 17; p++) {
+        snprintf(buf, sizeof(buf), "%.*g", p, x);
+        if (strtod(buf, NULL) == x) { break; }
+    }
+    lout_cstr(o, buf);
+    /* and still read back as a double. there is no inf or nan to print,
+       arithmetic, the reader and images all refuse them */
+    if (!strpbrk(buf, ".e")) { lout_cstr(o, ".0"); }
+}
+
+void lval_write_expr(lout* o, lval* v, char open, char close) {
+    lout_char(o, open);
+
     for (int i = 0; i < v->count; i++) {
-        /* print value */
-        lval_print(v->cell[i]);
+        /* write value */
+        lval_write(o, v->cell[i]);
 
         /* skip last element's trailing space */
         if (i != (v->count-1)) {
-            putchar(' ');
+            lout_char(o, ' ');
         }
     }
 
-    putchar(close);
+    lout_char(o, close);
 }
 
-/* Print an "lval" */
-void lval_print(lval* v) {
+void lval_write(lout* o, lval* v) {
     switch (v->type)
     {
-        case LVAL_NUM: printf("%li", v->num); break;
-        case LVAL_ERR: printf("Error: %s", v->err); break;
-        case LVAL_SYM: printf("%s", v->sym); break;
-        case LVAL_STR: lval_print_str(v); break;
+        case LVAL_NUM: lout_num(o, v->num); break;
+        case LVAL_DBL: lout_dbl(o, v->dbl); break;
+        case LVAL_BIG: {
+            char* s = lbig_str(v->big);
+            lout_cstr(o, s);
+            free(s);
+        }
+        break;
+        case LVAL_ERR: lout_cstr(o, "Error: "); lout_cstr(o, v->err); break;
+        case LVAL_SYM: lout_cstr(o, v->sym); break;
+        case LVAL_STR: lval_write_str(o, v); break;
         case LVAL_FUN:
             if(v->builtin) {
-                printf("<builtin>"); 
+                lout_cstr(o, "<builtin>");
             } else {
-                printf("(\\ "); lval_print(v->formals);
-                putchar(' '); lval_print(v->body); putchar(')');
-            }        
+                lout_cstr(o, "(\\ "); lval_write(o, v->formals);
+                lout_char(o, ' '); lval_write(o, v->body); lout_char(o, ')');
+            }
+        break;
+        case LVAL_SEXPR: lval_write_expr(o, v, '(', ')'); break;
+        case LVAL_QEXPR: lval_write_expr(o, lval_written(v), '{', '}'); break;
+        case LVAL_MAP: {
+            /* #{k v k v}, in insertion order */
+            ltable* t = v->table;
+            int first = 1;
+            lout_cstr(o, "#{");
+            for (int i = 0; i < t->used; i++) {
+                if (!t->keys[i]) { continue; }
+                if (!first) { lout_char(o, ' '); }
+                lval_write(o, t->keys[i]);
+                lout_char(o, ' ');
+                lval_write(o, t->vals[i]);
+                first = 0;
+            }
+            lout_char(o, '}');
+        }
+        break;
+        case LVAL_VEC:
+            lout_cstr(o, "#[");
+            for (int i = 0; i < v->end - v->lo; i++) {
+                if (i) { lout_char(o, ' '); }
+                lval_write(o, lvec_nth(v, i));
+            }
+            lout_char(o, ']');
         break;
-        case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-        case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+        /* printing would pull every item */
+        case LVAL_SEQ: lout_cstr(o, "<seq>"); break;
+        case LVAL_MEMO: lout_cstr(o, "<memo>"); break;
+        /* as written */
+        case LVAL_FOLD: lval_write(o, v->expr); break;
     }
 }
 
+/* Print an "lval" to stdout */
+void lval_print(lval* v) {
+    lout* o = lout_std();
+    lval_write(o, v);
+    lout_flush(o);
+}
+
 /* Print an "lval" followed by a newline */
-void lval_println(lval* v) { lval_print(v); putchar('\n'); }
+void lval_println(lval* v) {
+    lout* o = lout_std();
+    lval_write(o, v);
+    lout_char(o, '\n');
+    lout_flush(o);
+}
 
+/* evaluate the children of v in place, returns v or the first error */
 lval* lval_eval_sexpr(lenv* e, lval* v) {
+    /* children are replaced in place */
+    v = lval_unshare(v);
+
     /* evaluate children */
     for (int i = 0; i < v->count; i++) {
         v->cell[i] = lval_eval(e, v->cell[i]);
@@ -146,87 +527,334 @@ lval* lval_eval_sexpr(lenv* e, lval* v) {
     for (int i = 0; i < v->count; i++) {
         if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
     }
-    /* empty */
-    if (v->count == 0) { return v; }
-    /* single */
-    if (v->count == 1) { return lval_take(v, 0); }
-    /* ensure func as first element */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval* err = lval_err(
-            "S-Expression starts with incorrect type. "
-            "Got %s, Expected %s.",
-            ltype_name(f->type), ltype_name(LVAL_FUN));
-        lval_del(f); lval_del(v);
-        return err;
+    return v;
+}
+
+/* true if every symbol bound in o is also bound in n */
+int lenv_shadows(lenv* n, lenv* o) {
+    /* captured scopes are searched through o */
+    if (o->lex) { return 0; }
+
+    int old;
+    for (int i = 0; i < o->cap; i++) {
+        if (o->syms[i] && lenv_find(n, o->syms[i], &old) < 0) { return 0; }
     }
-    
-    lval* result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
+    for (int i = o->old_pos; i < o->old_cap; i++) {
+        if (o->old_syms[i] && lenv_find(n, o->old_syms[i], &old) < 0) { return 0; }
+    }
+    return 1;
 }
 
+/* evaluation loop: calls in tail position (a lambda body, the branch of
+   an if, the argument of eval) replace the current expression instead
+   of recursing, so tail recursion runs in constant C stack */
 lval* lval_eval(lenv* e, lval* v) {
-    if(v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
-    }    
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }    
+    /* lambdas whose envs are on the current chain, owned by this loop;
+       the last one's env is e */
+    lval* frames = NULL;
+
+    while (v->type == LVAL_SYM || v->type == LVAL_SEXPR || v->type == LVAL_FOLD) {
+        if (v->type == LVAL_FOLD) {
+            lval* x = NULL;
+            if (lfold_valid(v)) {
+                x = lval_ref(v->value);
+            } else {
+                /* a list folded whole runs as an s-expression */
+                x = lval_ref(v->expr);
+                if (x->type == LVAL_QEXPR) {
+                    x = lval_unshare(x);
+                    x->type = LVAL_SEXPR;
+                }
+            }
+            lval_del(v);
+            v = x;
+            continue;
+        }
+
+        if (v->type == LVAL_SYM) {
+            lval* x = lenv_get(e, v);
+            lval_del(v);
+            v = x;
+            break;
+        }
+
+        v = lval_eval_sexpr(e, v);
+        /* error, empty or single */
+        if (v->type == LVAL_ERR || v->count == 0) { break; }
+        if (v->count == 1) { v = lval_take(v, 0); break; }
+
+        /* ensure func as first element, calling binds into its env */
+        lval* f = lval_unshare(lval_pop(v, 0));
+        if (f->type != LVAL_FUN) {
+            lval* err = lval_err(
+                "S-Expression starts with incorrect type. "
+                "Got %s, Expected %s.",
+                ltype_name(f->type), ltype_name(LVAL_FUN));
+            lval_del(f); lval_del(v);
+            v = err;
+            break;
+        }
+
+        /* if and eval continue with the expression they would evaluate */
+        if (f->builtin == builtin_if || f->builtin == builtin_eval) {
+            v = (f->builtin == builtin_if) ? builtin_if_expr(v) : builtin_eval_expr(v);
+            lval_del(f);
+            continue;
+        }
+
+        if (f->builtin) {
+            v = f->builtin(e, v);
+            lval_del(f);
+            break;
+        }
+
+        /* error or partially applied function */
+        lval* r = lval_bind(e, f, v);
+        if (r) {
+            lval_del(f);
+            v = r;
+            break;
+        }
+
+        /* a frame that is wholly shadowed by the new one can never be
+           looked up again, so drop it rather than chain through it */
+        if (frames && frames->count && frames->cell[frames->count-1]->env == e
+            && lenv_shadows(f->env, e)) {
+            f->env->par = e->par;
+            lval_del(lval_pop(frames, frames->count-1));
+        } else {
+            f->env->par = e;
+        }
+
+        /* compiled bodies run on the vm, which takes over f */
+        if (lvm_enabled && f->body->code) {
+            v = lvm_call(f);
+            break;
+        }
+
+        if (!frames) { frames = lval_sexpr(); }
+        lval_add(frames, f);
+        e = f->env;
+
+        /* continue with the body */
+        v = lval_unshare(lval_ref(f->body));
+        v->type = LVAL_SEXPR;
+    }
+
+    if (frames) { lval_del(frames); }
     return v;
 }
 
+/* remove and return [i], v must not be shared */
 lval* lval_pop(lval* v, int i) {
+    lval_own_cells(v);
+
     /* find [i] */
     lval* x = v->cell[i];
-    /* remove [i] from list */
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));    
+    /* remove [i] from list, the front just moves the slice start */
+    if (i == 0) {
+        v->cell++;
+        v->buf->lo++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+        v->buf->hi--;
+    }
     v->count--;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+
+    /* drop the store once empty */
+    if (v->count == 0) {
+        lcells_del(v->buf);
+        v->buf = NULL;
+        v->cell = NULL;
+    }
 
     return x;
 }
 
 lval* lval_take(lval* v, int i) {
+    /* shared list stays intact, just reference the item */
+    if (v->refs > 1) {
+        lval* x = lval_ref(v->cell[i]);
+        lval_del(v);
+        return x;
+    }
+
     lval* x = lval_pop(v, i);
     lval_del(v);
     return x;
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
-    /* ensure all args are numbers */
+/* items [start, end) of v as a list sharing v's cell store */
+lval* lval_slice(lval* v, int start, int end) {
+    if (v->refs > 1) {
+        lval* x = lval_copy(v);
+        lval_del(v);
+        v = x;
+    }
+
+    v->cell += start;
+    v->count = end - start;
+
+    /* store is ours alone, release what fell outside */
+    if (!v->buf) { return v; }
+    if (v->buf->refs == 1) { lval_own_cells(v); }
+    if (v->count == 0) {
+        lcells_del(v->buf);
+        v->buf = NULL;
+        v->cell = NULL;
+    }
+    return v;
+}
+
+char* lmath_names[] = { "+", "-", "*", "/" };
+
+lval* builtin_op(lenv* e, lval* a, int op) {
+    /* ensure all args are numbers, fixnums take the fast path */
+    int fix = 1;
     for (int i = 0; i < a->count; i++) {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
+        LASSERT(a, lval_is_num(a->cell[i]),
+            "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+            lmath_names[op], i, ltype_name(a->cell[i]->type), ltype_name(LVAL_NUM));
+        fix &= a->cell[i]->type == LVAL_NUM;
     }
 
-    lval* x = lval_pop(a, 0);
-    
-    /* unary negation */
-    if ((strcmp(op, "-") == 0) && a->count == 0) {
-        x->num = -x->num;
+    lval* x = fix ? lmath_fold(op, a->cell, a->count) : lnum_fold(op, a->cell, a->count);
+    lval_del(a);
+    return x;
+}
+
+/* fold fixnums xs left to right with op, one loop per operator */
+lval* lmath_fold(int op, lval** xs, int n) {
+    long x = xs[0]->num;
+    int over = 0;
+
+    switch (op) {
+        case LMATH_ADD:
+            for (int i = 1; i < n; i++) {
+                over |= __builtin_add_overflow(x, xs[i]->num, &x);
+            }
+        break;
+        case LMATH_SUB:
+            /* unary negation */
+            if (n == 1) { over = __builtin_sub_overflow(0, x, &x); }
+            for (int i = 1; i < n; i++) {
+                over |= __builtin_sub_overflow(x, xs[i]->num, &x);
+            }
+        break;
+        case LMATH_MUL:
+            for (int i = 1; i < n; i++) {
+                over |= __builtin_mul_overflow(x, xs[i]->num, &x);
+            }
+        break;
+        case LMATH_DIV:
+            for (int i = 1; i < n && !over; i++) {
+                long y = xs[i]->num;
+                if (y == 0) { return lval_err("Division by zero."); }
+                if (x == LONG_MIN && y == -1) { over = 1; }
+                else { x /= y; }
+            }
+        break;
     }
 
-    while (a->count > 0) {
-        lval* y = lval_pop(a, 0);
-        
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) {
-           if (y->num == 0) {
-              lval_del(x); lval_del(y);
-              x= lval_err("Division by zero."); break;
-           }
-           x->num /= y->num;
+    /* past a long, start over with bignums */
+    if (over) { return lnum_fold(op, xs, n); }
+    return lval_num(x);
+}
+
+int lval_is_num(lval* v) {
+    return v->type == LVAL_NUM || v->type == LVAL_BIG || v->type == LVAL_DBL;
+}
+
+double lnum_dbl(lval* v) {
+    switch (v->type) {
+        case LVAL_NUM: return (double)v->num;
+        case LVAL_BIG: return lbig_double(v->big);
+        default: return v->dbl;
+    }
+}
+
+/* x op y for any numbers, doubles if either is one */
+lval* lnum_op2(int op, lval* x, lval* y) {
+    if (x->type == LVAL_DBL || y->type == LVAL_DBL) {
+        double a = lnum_dbl(x);
+        double b = lnum_dbl(y);
+        double r;
+        switch (op) {
+            case LMATH_ADD: r = a + b; break;
+            case LMATH_SUB: r = a - b; break;
+            case LMATH_MUL: r = a * b; break;
+            default:
+                if (b == 0) { return lval_err("Division by zero."); }
+                r = a / b;
         }
+        /* inf and nan have no literal to print as */
+        if (!isfinite(r)) { return lval_err("Number out of range."); }
+        return lval_dbl(r);
+    }
 
-        lval_del(y);
+    lbig* a = x->type == LVAL_BIG ? x->big : lbig_long(x->num);
+    lbig* b = y->type == LVAL_BIG ? y->big : lbig_long(y->num);
+    lbig* r = NULL;
+    switch (op) {
+        case LMATH_ADD: r = lbig_add(a, b); break;
+        case LMATH_SUB: r = lbig_sub(a, b); break;
+        case LMATH_MUL: r = lbig_mul(a, b); break;
+        case LMATH_DIV: if (b->sign) { r = lbig_div(a, b); } break;
+    }
+    if (x->type != LVAL_BIG) { free(a); }
+    if (y->type != LVAL_BIG) { free(b); }
+    return r ? lval_big(r) : lval_err("Division by zero.");
+}
+
+/* as lmath_fold for any numbers */
+lval* lnum_fold(int op, lval** xs, int n) {
+    /* unary negation */
+    if (op == LMATH_SUB && n == 1) { return lnum_op2(op, lval_num(0), xs[0]); }
+
+    lval* x = lval_ref(xs[0]);
+    for (int i = 1; i < n && x->type != LVAL_ERR; i++) {
+        lval* r = lnum_op2(op, x, xs[i]);
+        lval_del(x);
+        x = r;
     }
-    
-    lval_del(a);
     return x;
 }
 
+/* order of two integers, fixnum or bignum */
+int lnum_cmp(lval* x, lval* y) {
+    if (x->type == LVAL_NUM && y->type == LVAL_NUM) {
+        return (x->num > y->num) - (x->num < y->num);
+    }
+    /* bignums are past every fixnum */
+    if (x->type == LVAL_NUM) { return -y->big->sign; }
+    if (y->type == LVAL_NUM) { return x->big->sign; }
+    return lbig_cmp(x->big, y->big);
+}
+
+/* ordering op on any numbers, as doubles if either is one */
+int lnum_ord(int op, lval* x, lval* y) {
+    if (x->type == LVAL_DBL || y->type == LVAL_DBL) {
+        double a = lnum_dbl(x);
+        double b = lnum_dbl(y);
+        switch (op) {
+            case LORD_GT: return a > b;
+            case LORD_LT: return a < b;
+            case LORD_GE: return a >= b;
+            default: return a <= b;
+        }
+    }
+    return lord_test(op, lnum_cmp(x, y), 0);
+}
+
+/* operator of a math builtin, or -1 */
+int lmath_op(lbuiltin f) {
+    if (f == builtin_add) { return LMATH_ADD; }
+    if (f == builtin_sub) { return LMATH_SUB; }
+    if (f == builtin_mul) { return LMATH_MUL; }
+    if (f == builtin_div) { return LMATH_DIV; }
+    return -1;
+}
+
 lval* builtin_head(lenv* e, lval* a) {
     LASSERT_NUM("head", a, 1);
     LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
@@ -234,8 +862,10 @@ lval* builtin_head(lenv* e, lval* a) {
 
     lval* v = lval_take(a, 0);
 
-    while(v->count > 1) { lval_del(lval_pop(v, 1)); }
-    return v;
+    /* fresh list so a shared store is not kept alive by it */
+    lval* x = lval_add(lval_qexpr(), lval_ref(v->cell[0]));
+    lval_del(v);
+    return x;
 }
 
 lval* builtin_tail(lenv* e, lval* a) {
@@ -243,10 +873,9 @@ lval* builtin_tail(lenv* e, lval* a) {
     LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
     LASSERT_NOT_EMPTY("tail", a, 0);
 
+    /* O(1) slice, sharing the store with the argument */
     lval* v = lval_take(a, 0);
-
-    lval_del(lval_pop(v, 0));
-    return v;
+    return lval_slice(v, 1, v->count);
 }
 
 lval* builtin_list(lenv* e, lval* a) {
@@ -254,13 +883,18 @@ lval* builtin_list(lenv* e, lval* a) {
     return a;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
+/* the expression eval would evaluate, or an error */
+lval* builtin_eval_expr(lval* a) {
     LASSERT_NUM("eval", a, 1);
     LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-    lval* x = lval_take(a, 0);
+    lval* x = lval_unshare(lval_take(a, 0));
     x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return x;
+}
+
+lval* builtin_eval(lenv* e, lval* a) {
+    return lval_eval(e, builtin_eval_expr(a));
 }
 
 lval* builtin_join(lenv* e, lval* a) {
@@ -279,134 +913,1194 @@ lval* builtin_join(lenv* e, lval* a) {
     return x;
 }
 
-lval* lval_join(lval* x, lval* y) {
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+/* item i of l as fst would give it, evaluated in e */
+lval* lval_item(lenv* e, lval* l, int i) {
+    lval* x = l->cell[i];
+    /* only symbols, s-expressions and folds change when evaluated */
+    if (x->type != LVAL_SYM && x->type != LVAL_SEXPR && x->type != LVAL_FOLD) {
+        return lval_ref(x);
     }
-    
-    lval_del(y);
-    return x;
+    return lval_eval(e, lval_ref(x));
 }
 
-lval* lval_fun(lbuiltin func) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    v->builtin = func;
-    return v;
+/* call f with the args in a, which it takes; f is left as it was */
+lval* lval_apply(lenv* e, lval* f, lval* a) {
+    if (f->builtin) { return f->builtin(e, a); }
+
+    /* calling binds into the function's env */
+    f = lval_copy(f);
+    lval* r = lval_call(e, f, a);
+    lval_del(f);
+    return r;
 }
 
-lval* lval_copy(lval* v) {
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+/* (f x) or (f x y) as an argument list */
+lval* lval_args(lval* x, lval* y) {
+    lval* a = lval_add(lval_sexpr(), x);
+    return y ? lval_add(a, y) : a;
+}
 
-    switch (v->type) {
-        /* copy func and num directly */
-        case LVAL_FUN:
-            if(v->builtin) {
-                x->builtin = v->builtin;
-            } else {
-                x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
-            }         
-        break;
-        case LVAL_NUM: x->num = v->num; break;
-        /* copy strings with malloc and strcpy  */
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err); break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str); break;
-        /* copy lists iteratively and recursively */
-        case LVAL_SEXPR:
-        case LVAL_QEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
-        break;            
-    }
+/* n or l out of range for a list function taking them */
+lval* lval_range_err(char* func, long n, lval* l) {
+    return lval_err("Function '%s' passed index %li for a list of %i items.",
+        func, n, l->count);
+}
+
+/* natives for the list functions lib-std.lispy had in lisp; they keep
+   those semantics, items are evaluated as fst does (see lib-std-ref) */
 
+lval* builtin_len(lenv* e, lval* a) {
+    LASSERT_NUM("len", a, 1);
+    LASSERT_TYPE("len", a, 0, LVAL_QEXPR);
+
+    lval* x = lval_num(a->cell[0]->count);
+    lval_del(a);
     return x;
 }
 
-void lenv_del(lenv* e) {
-    for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+lval* builtin_nth(lenv* e, lval* a) {
+    LASSERT_NUM("nth", a, 2);
+    LASSERT_TYPE("nth", a, 0, LVAL_NUM);
+    LASSERT_TYPE("nth", a, 1, LVAL_QEXPR);
+
+    long n = a->cell[0]->num;
+    lval* l = a->cell[1];
+    lval* x = (n >= 0 && n < l->count) ? lval_item(e, l, n) : lval_range_err("nth", n, l);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_last(lenv* e, lval* a) {
+    LASSERT_NUM("last", a, 1);
+    LASSERT_TYPE("last", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("last", a, 0);
+
+    lval* l = a->cell[0];
+    lval* x = lval_item(e, l, l->count - 1);
+    lval_del(a);
+    return x;
+}
+
+/* first n items, sharing the store */
+lval* builtin_take(lenv* e, lval* a) {
+    LASSERT_NUM("take", a, 2);
+    LASSERT_TYPE("take", a, 0, LVAL_NUM);
+    LASSERT_TYPE("take", a, 1, LVAL_QEXPR);
+
+    long n = a->cell[0]->num;
+    if (n < 0 || n > a->cell[1]->count) {
+        lval* err = lval_range_err("take", n, a->cell[1]);
+        lval_del(a);
+        return err;
+    }
+
+    lval* l = lval_take(a, 1);
+    return lval_slice(l, 0, n);
+}
+
+/* all but the first n items, sharing the store */
+lval* builtin_drop(lenv* e, lval* a) {
+    LASSERT_NUM("drop", a, 2);
+    LASSERT_TYPE("drop", a, 0, LVAL_NUM);
+    LASSERT_TYPE("drop", a, 1, LVAL_QEXPR);
+
+    long n = a->cell[0]->num;
+    if (n < 0 || n > a->cell[1]->count) {
+        lval* err = lval_range_err("drop", n, a->cell[1]);
+        lval_del(a);
+        return err;
+    }
+
+    lval* l = lval_take(a, 1);
+    return lval_slice(l, n, l->count);
+}
+
+lval* builtin_elem(lenv* e, lval* a) {
+    LASSERT_NUM("elem", a, 2);
+    LASSERT_TYPE("elem", a, 1, LVAL_QEXPR);
+
+    lval* l = a->cell[1];
+    int found = 0;
+    for (int i = 0; i < l->count && !found; i++) {
+        lval* y = lval_item(e, l, i);
+        if (y->type == LVAL_ERR) { lval_del(a); return y; }
+        found = lval_eq(a->cell[0], y);
+        lval_del(y);
+    }
+
+    lval_del(a);
+    return lval_num(found);
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+    LASSERT_NUM("map", a, 2);
+    LASSERT_TYPE("map", a, 0, LVAL_FUN);
+    LASSERT_TYPE("map", a, 1, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr_cap(l->count);
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_item(e, l, i);
+        if (y->type != LVAL_ERR) { y = lval_apply(e, f, lval_args(y, NULL)); }
+        if (y->type == LVAL_ERR) { lval_del(x); lval_del(a); return y; }
+        lval_add(x, y);
+    }
+
+    lval_del(a);
+    return x;
+}
+
+/* the items, unevaluated, for which f gives a non-zero number */
+lval* builtin_filter(lenv* e, lval* a) {
+    LASSERT_NUM("filter", a, 2);
+    LASSERT_TYPE("filter", a, 0, LVAL_FUN);
+    LASSERT_TYPE("filter", a, 1, LVAL_QEXPR);
+
+    lval* f = a->cell[0];
+    lval* l = a->cell[1];
+    lval* x = lval_qexpr();
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_item(e, l, i);
+        if (y->type != LVAL_ERR) { y = lval_apply(e, f, lval_args(y, NULL)); }
+        if (y->type == LVAL_ERR) { lval_del(x); lval_del(a); return y; }
+        if (y->type != LVAL_NUM) {
+            lval* err = lval_err("Function 'filter' got %s from its function, Expected %s.",
+                ltype_name(y->type), ltype_name(LVAL_NUM));
+            lval_del(y); lval_del(x); lval_del(a);
+            return err;
+        }
+        if (y->num) { lval_add(x, lval_ref(l->cell[i])); }
+        lval_del(y);
+    }
+
+    lval_del(a);
+    return x;
+}
+
+/* fold items left to right with f from z, op >= 0 folds numbers with
+   that math operator instead */
+lval* lval_foldl(lenv* e, char* func, lval* f, int op, lval* z, lval* l) {
+    for (int i = 0; i < l->count; i++) {
+        lval* y = lval_item(e, l, i);
+        if (y->type == LVAL_ERR) { lval_del(z); return y; }
+
+        if (op < 0) {
+            z = lval_apply(e, f, lval_args(z, y));
+        } else if (lval_is_num(z) && lval_is_num(y)) {
+            lval* xs[2] = { z, y };
+            lval* r = (z->type == LVAL_NUM && y->type == LVAL_NUM)
+                ? lmath_fold(op, xs, 2) : lnum_fold(op, xs, 2);
+            lval_del(z); lval_del(y);
+            z = r;
+        } else {
+            lval* err = lval_err(
+                "Function '%s' passed incorrect type for item %i. "
+                "Got %s, Expected %s.",
+                func, i, ltype_name(y->type), ltype_name(LVAL_NUM));
+            lval_del(z); lval_del(y);
+            return err;
+        }
+        if (z->type == LVAL_ERR) { return z; }
+    }
+    return z;
+}
+
+lval* builtin_foldl(lenv* e, lval* a) {
+    LASSERT_NUM("foldl", a, 3);
+    LASSERT_TYPE("foldl", a, 0, LVAL_FUN);
+    LASSERT_TYPE("foldl", a, 2, LVAL_QEXPR);
+
+    lval* x = lval_foldl(e, "foldl", a->cell[0], -1, lval_ref(a->cell[1]), a->cell[2]);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_sum(lenv* e, lval* a) {
+    LASSERT_NUM("sum", a, 1);
+    LASSERT_TYPE("sum", a, 0, LVAL_QEXPR);
+
+    lval* x = lval_foldl(e, "sum", NULL, LMATH_ADD, lval_num(0), a->cell[0]);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_product(lenv* e, lval* a) {
+    LASSERT_NUM("product", a, 1);
+    LASSERT_TYPE("product", a, 0, LVAL_QEXPR);
+
+    lval* x = lval_foldl(e, "product", NULL, LMATH_MUL, lval_num(1), a->cell[0]);
+    lval_del(a);
+    return x;
+}
+
+/* empty table with room for cap entries */
+ltable* ltable_new(int cap) {
+    if (cap < LTABLE_MIN) { cap = LTABLE_MIN; }
+    ltable* t = malloc(sizeof(ltable));
+    t->keys = malloc(sizeof(lval*) * cap);
+    t->vals = malloc(sizeof(lval*) * cap);
+    t->hashes = malloc(sizeof(unsigned long) * cap);
+    t->count = 0;
+    t->used = 0;
+    t->cap = cap;
+    t->index = NULL;
+    t->icap = 0;
+    ltable_rehash(t, cap);
+    return t;
+}
+
+void ltable_del(ltable* t) {
+    for (int i = 0; i < t->used; i++) {
+        if (t->keys[i]) { lval_del(t->keys[i]); lval_del(t->vals[i]); }
+    }
+    free(t->keys);
+    free(t->vals);
+    free(t->hashes);
+    free(t->index);
+    free(t);
+}
+
+/* same entries as t, referenced again */
+ltable* ltable_copy(ltable* t) {
+    ltable* n = ltable_new(t->count);
+    for (int i = 0; i < t->used; i++) {
+        if (!t->keys[i]) { continue; }
+        int j = n->used++;
+        n->keys[j] = lval_ref(t->keys[i]);
+        n->vals[j] = lval_ref(t->vals[i]);
+        n->hashes[j] = t->hashes[i];
+    }
+    n->count = n->used;
+    ltable_rehash(n, n->cap);
+    return n;
+}
+
+/* drop deleted entries and rebuild the index with room for cap
+   entries, keeping it at most half full */
+void ltable_rehash(ltable* t, int cap) {
+    int used = 0;
+    for (int i = 0; i < t->used; i++) {
+        if (!t->keys[i]) { continue; }
+        t->keys[used] = t->keys[i];
+        t->vals[used] = t->vals[i];
+        t->hashes[used] = t->hashes[i];
+        used++;
+    }
+    t->used = used;
+
+    if (cap > t->cap) {
+        t->keys = realloc(t->keys, sizeof(lval*) * cap);
+        t->vals = realloc(t->vals, sizeof(lval*) * cap);
+        t->hashes = realloc(t->hashes, sizeof(unsigned long) * cap);
+        t->cap = cap;
+    }
+
+    int icap = 8;
+    while (icap < t->cap * 2) { icap *= 2; }
+    if (icap != t->icap) {
+        free(t->index);
+        t->index = malloc(sizeof(int) * icap);
+        t->icap = icap;
+    }
+    memset(t->index, 0xff, sizeof(int) * icap);
+    t->first = 0;
+    for (int i = 0; i < used; i++) {
+        int s = t->hashes[i] & (icap - 1);
+        while (t->index[s] >= 0) { s = (s + 1) & (icap - 1); }
+        t->index[s] = i;
+    }
+}
+
+/* entry number of k, whose hash is h, or -1 */
+int ltable_find(ltable* t, lval* k, unsigned long h) {
+    int s = h & (t->icap - 1);
+    while (t->index[s] >= 0) {
+        int i = t->index[s];
+        /* slots of deleted entries are passed over */
+        if (t->keys[i] && t->hashes[i] == h && lval_eq(t->keys[i], k)) { return i; }
+        s = (s + 1) & (t->icap - 1);
+    }
+    return -1;
+}
+
+/* bind k to v, taking both */
+void ltable_put(ltable* t, lval* k, lval* v) {
+    unsigned long h = lval_hash(k);
+    int i = ltable_find(t, k, h);
+    if (i >= 0) {
+        lval_del(t->vals[i]);
+        t->vals[i] = v;
+        lval_del(k);
+        return;
+    }
+
+    /* full, compact if deletes left room, otherwise grow */
+    if (t->used == t->cap) {
+        ltable_rehash(t, t->count <= t->cap / 2 ? t->cap : t->cap * 2);
+    }
+
+    i = t->used++;
+    t->keys[i] = k;
+    t->vals[i] = v;
+    t->hashes[i] = h;
+    t->count++;
+
+    int s = h & (t->icap - 1);
+    while (t->index[s] >= 0) { s = (s + 1) & (t->icap - 1); }
+    t->index[s] = i;
+}
+
+/* remove k, true if it was there */
+int ltable_remove(ltable* t, lval* k) {
+    int i = ltable_find(t, k, lval_hash(k));
+    if (i < 0) { return 0; }
+    lval_del(t->keys[i]);
+    lval_del(t->vals[i]);
+    t->keys[i] = NULL;
+    t->count--;
+    return 1;
+}
+
+/* entry number of the earliest put still there, t not empty */
+int ltable_oldest(ltable* t) {
+    while (!t->keys[t->first]) { t->first++; }
+    return t->first;
+}
+
+/* empty map type lval */
+lval* lval_map(void) {
+    lval* v = lval_new(LVAL_MAP);
+    v->table = ltable_new(LTABLE_MIN);
+    return v;
+}
+
+/* map of the {k v} pairs in l, later keys win */
+lval* lval_map_pairs(lval* l) {
+    lval* m = lval_map();
+    ltable_rehash(m->table, l->count);
+    for (int i = 0; i < l->count; i++) {
+        lval* p = l->cell[i];
+        if (p->type != LVAL_QEXPR || p->count != 2) {
+            lval_del(m);
+            return lval_err("Function 'map-new' passed an item that is not a {key value} pair.");
+        }
+        ltable_put(m->table, lval_ref(p->cell[0]), lval_ref(p->cell[1]));
+    }
+    return m;
+}
+
+lval* builtin_map_new(lenv* e, lval* a) {
+    LASSERT_NUM("map-new", a, 1);
+    LASSERT_TYPE("map-new", a, 0, LVAL_QEXPR);
+
+    lval* m = lval_map_pairs(a->cell[0]);
+    lval_del(a);
+    return m;
+}
+
+/* value of a key, or the default if one is given */
+lval* builtin_map_get(lenv* e, lval* a) {
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function 'map-get' passed incorrect number of arguments. "
+        "Got %i, Expected 2 or 3.", a->count);
+    LASSERT_TYPE("map-get", a, 0, LVAL_MAP);
+
+    ltable* t = a->cell[0]->table;
+    lval* k = a->cell[1];
+    int i = ltable_find(t, k, lval_hash(k));
+    if (i >= 0) {
+        lval* x = lval_ref(t->vals[i]);
+        lval_del(a);
+        return x;
+    }
+    LASSERT(a, a->count == 3, "Function 'map-get' passed a key not in the map.");
+    return lval_take(a, 2);
+}
+
+/* maps are values like lists, a map still referenced elsewhere is
+   copied before it changes */
+lval* builtin_map_put(lenv* e, lval* a) {
+    LASSERT_NUM("map-put", a, 3);
+    LASSERT_TYPE("map-put", a, 0, LVAL_MAP);
+
+    lval* m = lval_unshare(lval_pop(a, 0));
+    lval* k = lval_pop(a, 0);
+    ltable_put(m->table, k, lval_take(a, 0));
+    return m;
+}
+
+lval* builtin_map_del(lenv* e, lval* a) {
+    LASSERT_NUM("map-del", a, 2);
+    LASSERT_TYPE("map-del", a, 0, LVAL_MAP);
+
+    lval* m = lval_pop(a, 0);
+    /* nothing to remove, no copy needed */
+    lval* k = a->cell[0];
+    if (ltable_find(m->table, k, lval_hash(k)) >= 0) {
+        m = lval_unshare(m);
+        ltable_remove(m->table, k);
+    }
+    lval_del(a);
+    return m;
+}
+
+/* keys in the order they were first put */
+lval* builtin_map_keys(lenv* e, lval* a) {
+    LASSERT_NUM("map-keys", a, 1);
+    LASSERT_TYPE("map-keys", a, 0, LVAL_MAP);
+
+    ltable* t = a->cell[0]->table;
+    lval* x = lval_qexpr_cap(t->count);
+    for (int i = 0; i < t->used; i++) {
+        if (t->keys[i]) { lval_add(x, lval_ref(t->keys[i])); }
+    }
+    lval_del(a);
+    return x;
+}
+
+/* vector of the items of l */
+lval* lval_vec_list(lval* l) {
+    lval* v = lval_vec();
+    for (int i = 0; i < l->count; i++) { v = lvec_push(v, lval_ref(l->cell[i])); }
+    return v;
+}
+
+lval* lvec_range_err(char* func, long n, lval* v) {
+    return lval_err("Function '%s' passed index %li for a vector of %i items.",
+        func, n, v->end - v->lo);
+}
+
+lval* builtin_vec(lenv* e, lval* a) {
+    LASSERT_NUM("vec", a, 1);
+    LASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+    lval* v = lval_vec_list(a->cell[0]);
+    lval_del(a);
+    return v;
+}
+
+lval* builtin_vec_nth(lenv* e, lval* a) {
+    LASSERT_NUM("vec-nth", a, 2);
+    LASSERT_TYPE("vec-nth", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-nth", a, 1, LVAL_NUM);
+
+    lval* v = a->cell[0];
+    long n = a->cell[1]->num;
+    lval* x = (n >= 0 && n < v->end - v->lo) ? lval_ref(lvec_nth(v, n))
+        : lvec_range_err("vec-nth", n, v);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_vec_len(lenv* e, lval* a) {
+    LASSERT_NUM("vec-len", a, 1);
+    LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+
+    lval* x = lval_num(a->cell[0]->end - a->cell[0]->lo);
+    lval_del(a);
+    return x;
+}
+
+/* vectors are values like maps; the updates below change a vector in
+   place when nothing else references it, otherwise they share all but
+   the changed path with it */
+lval* builtin_vec_push(lenv* e, lval* a) {
+    LASSERT_NUM("vec-push", a, 2);
+    LASSERT_TYPE("vec-push", a, 0, LVAL_VEC);
+
+    lval* v = lval_pop(a, 0);
+    return lvec_push(v, lval_take(a, 0));
+}
+
+lval* builtin_vec_set(lenv* e, lval* a) {
+    LASSERT_NUM("vec-set", a, 3);
+    LASSERT_TYPE("vec-set", a, 0, LVAL_VEC);
+    LASSERT_TYPE("vec-set", a, 1, LVAL_NUM);
+
+    lval* v = a->cell[0];
+    long n = a->cell[1]->num;
+    if (n < 0 || n >= v->end - v->lo) {
+        lval* err = lvec_range_err("vec-set", n, v);
+        lval_del(a);
+        return err;
+    }
+
+    v = lval_pop(a, 0);
+    lval_del(lval_pop(a, 0));
+    return lvec_set(v, n, lval_take(a, 0));
+}
+
+lval* builtin_vec_pop(lenv* e, lval* a) {
+    LASSERT_NUM("vec-pop", a, 1);
+    LASSERT_TYPE("vec-pop", a, 0, LVAL_VEC);
+    LASSERT(a, a->cell[0]->end > a->cell[0]->lo, "Function 'vec-pop' passed an empty vector.");
+
+    return lvec_pop(lval_take(a, 0));
+}
+
+lval* builtin_vec_rest(lenv* e, lval* a) {
+    LASSERT_NUM("vec-rest", a, 1);
+    LASSERT_TYPE("vec-rest", a, 0, LVAL_VEC);
+    LASSERT(a, a->cell[0]->end > a->cell[0]->lo, "Function 'vec-rest' passed an empty vector.");
+
+    return lvec_rest(lval_take(a, 0));
+}
+
+/* items as a q-expression */
+lval* builtin_vec_list(lenv* e, lval* a) {
+    LASSERT_NUM("vec-list", a, 1);
+    LASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+
+    lval* v = a->cell[0];
+    int n = v->end - v->lo;
+    lval* x = lval_qexpr_cap(n);
+    for (int i = 0; i < n; i++) { lval_add(x, lval_ref(lvec_nth(v, i))); }
+    lval_del(a);
+    return x;
+}
+
+/* lazy sequence type lval, taking fn and src, either may be NULL */
+lval* lval_seq(int kind, lval* fn, lval* src) {
+    lval* v = lval_new(LVAL_SEQ);
+    v->seq = calloc(1, sizeof(lseq));
+    v->seq->kind = kind;
+    v->seq->fn = fn;
+    v->seq->src = src;
+    return v;
+}
+
+void lseq_del(lseq* s) {
+    if (s->fn) { lval_del(s->fn); }
+    if (s->src) { lval_del(s->src); }
+    free(s);
+}
+
+lseq* lseq_copy(lseq* s) {
+    lseq* x = malloc(sizeof(lseq));
+    *x = *s;
+    if (x->fn) { lval_ref(x->fn); }
+    if (x->src) { lval_ref(x->src); }
+    return x;
+}
+
+/* true if the lazy functions can pull items from v */
+int lval_is_seqable(lval* v) {
+    return v->type == LVAL_QEXPR || v->type == LVAL_VEC || v->type == LVAL_SEQ;
+}
+
+/* iterator at the first item of v, which must outlive it */
+lsiter* lsiter_new(lval* v) {
+    lsiter* it = calloc(1, sizeof(lsiter));
+    it->v = v;
+    if (v->type != LVAL_SEQ) { return it; }
+
+    lseq* s = v->seq;
+    switch (s->kind) {
+        case LSEQ_RANGE: it->i = s->from; break;
+        case LSEQ_MAP:
+        case LSEQ_FILTER:
+        case LSEQ_TAKE: it->src = lsiter_new(s->src); break;
+        case LSEQ_FORMS: {
+            /* as lval_load reads, a mapping needs no file kept open */
+            FILE* f = fopen(s->src->str, "rb");
+            if (!f) { break; }
+            it->r = malloc(sizeof(lreader));
+            lmap* m = lmap_open(f);
+            if (m) {
+                *it->r = lreader_map(m);
+                lmap_del(m);
+                fclose(f);
+            } else {
+                *it->r = lreader_file(f);
+                it->f = f;
+            }
+        }
+        break;
+    }
+    return it;
+}
+
+void lsiter_del(lsiter* it) {
+    if (it->src) { lsiter_del(it->src); }
+    if (it->r) { lreader_del(it->r); free(it->r); }
+    if (it->f) { fclose(it->f); }
+    free(it);
+}
+
+/* next item, NULL after the last; an error item ends the items */
+lval* lsiter_next(lenv* e, lsiter* it) {
+    lval* v = it->v;
+    if (v->type == LVAL_QEXPR) {
+        return it->i < v->count ? lval_item(e, v, it->i++) : NULL;
+    }
+    if (v->type == LVAL_VEC) {
+        return it->i < v->end - v->lo ? lval_ref(lvec_nth(v, it->i++)) : NULL;
+    }
+
+    lseq* s = v->seq;
+    switch (s->kind) {
+        case LSEQ_RANGE: {
+            if (it->done) { return NULL; }
+            if (!s->open && (s->step > 0 ? it->i >= s->to : it->i <= s->to)) {
+                return NULL;
+            }
+            lval* x = lval_num(it->i);
+            /* the next number would not fit a long, this was the last */
+            if (__builtin_add_overflow(it->i, s->step, &it->i)) { it->done = 1; }
+            return x;
+        }
+        case LSEQ_MAP: {
+            lval* y = lsiter_next(e, it->src);
+            if (!y || y->type == LVAL_ERR) { return y; }
+            return lval_apply(e, s->fn, lval_args(y, NULL));
+        }
+        case LSEQ_FILTER:
+            for (;;) {
+                lval* y = lsiter_next(e, it->src);
+                if (!y || y->type == LVAL_ERR) { return y; }
+                lval* t = lval_apply(e, s->fn, lval_args(lval_ref(y), NULL));
+                if (t->type == LVAL_ERR) { lval_del(y); return t; }
+                if (t->type != LVAL_NUM) {
+                    lval* err = lval_err(
+                        "Function 'lazy-filter' got %s from its function, "
+                        "Expected %s.",
+                        ltype_name(t->type), ltype_name(LVAL_NUM));
+                    lval_del(t); lval_del(y);
+                    return err;
+                }
+                int keep = t->num != 0;
+                lval_del(t);
+                if (keep) { return y; }
+                lval_del(y);
+            }
+        case LSEQ_TAKE:
+            if (it->i >= s->to) { return NULL; }
+            it->i++;
+            return lsiter_next(e, it->src);
+        case LSEQ_FORMS:
+            if (!it->r) { return lval_err("Could not load Library %s", s->src->str); }
+            return lreader_next(it->r);
+    }
+    return NULL;
+}
+
+/* (range from [to [step]]), without to the numbers go on */
+lval* builtin_range(lenv* e, lval* a) {
+    LASSERT(a, a->count >= 1 && a->count <= 3,
+        "Function 'range' passed incorrect number of arguments. "
+        "Got %i, Expected 1 to 3.", a->count);
+    for (int i = 0; i < a->count; i++) { LASSERT_TYPE("range", a, i, LVAL_NUM); }
+    LASSERT(a, a->count < 3 || a->cell[2]->num != 0, "Function 'range' passed a step of 0.");
+
+    lval* x = lval_seq(LSEQ_RANGE, NULL, NULL);
+    x->seq->from = a->cell[0]->num;
+    x->seq->open = a->count == 1;
+    x->seq->to = a->count > 1 ? a->cell[1]->num : 0;
+    x->seq->step = a->count > 2 ? a->cell[2]->num : 1;
+    lval_del(a);
+    return x;
+}
+
+/* source argument i of a lazy function */
+#define LASSERT_SEQABLE(func, args, index) \
+    LASSERT(args, lval_is_seqable(args->cell[index]), \
+    "Function '%s' passed incorrect type for argument %i. " \
+    "Got %s, Expected a list, vector or sequence.", \
+    func, index, ltype_name(args->cell[index]->type))
+
+lval* builtin_lazy_map(lenv* e, lval* a) {
+    LASSERT_NUM("lazy-map", a, 2);
+    LASSERT_TYPE("lazy-map", a, 0, LVAL_FUN);
+    LASSERT_SEQABLE("lazy-map", a, 1);
+
+    lval* f = lval_pop(a, 0);
+    return lval_seq(LSEQ_MAP, f, lval_take(a, 0));
+}
+
+lval* builtin_lazy_filter(lenv* e, lval* a) {
+    LASSERT_NUM("lazy-filter", a, 2);
+    LASSERT_TYPE("lazy-filter", a, 0, LVAL_FUN);
+    LASSERT_SEQABLE("lazy-filter", a, 1);
+
+    lval* f = lval_pop(a, 0);
+    return lval_seq(LSEQ_FILTER, f, lval_take(a, 0));
+}
+
+lval* builtin_lazy_take(lenv* e, lval* a) {
+    LASSERT_NUM("lazy-take", a, 2);
+    LASSERT_TYPE("lazy-take", a, 0, LVAL_NUM);
+    LASSERT_SEQABLE("lazy-take", a, 1);
+    LASSERT(a, a->cell[0]->num >= 0, "Function 'lazy-take' passed a negative count %li.",
+        a->cell[0]->num);
+
+    long n = a->cell[0]->num;
+    lval* x = lval_seq(LSEQ_TAKE, NULL, lval_take(a, 1));
+    x->seq->to = n;
+    return x;
+}
+
+/* the items as a q-expression, or the first error */
+lval* builtin_realize(lenv* e, lval* a) {
+    LASSERT_NUM("realize", a, 1);
+    LASSERT_SEQABLE("realize", a, 0);
+
+    lsiter* it = lsiter_new(a->cell[0]);
+    lval* x = lval_qexpr();
+    lval* y;
+    while ((y = lsiter_next(e, it))) {
+        if (y->type == LVAL_ERR) { lval_del(x); x = y; break; }
+        lval_add(x, y);
+    }
+    lsiter_del(it);
+    lval_del(a);
+    return x;
+}
+
+/* empty cache type lval for fn, taking fn */
+lval* lval_memo(lval* fn, long max) {
+    lval* v = lval_new(LVAL_MEMO);
+    v->memo = calloc(1, sizeof(lmemo));
+    v->memo->refs = 1;
+    v->memo->fn = fn;
+    v->memo->table = ltable_new(LTABLE_MIN);
+    v->memo->max = max;
+    return v;
+}
+
+void lmemo_del(lmemo* m) {
+    if (--m->refs > 0) { return; }
+    lval_del(m->fn);
+    ltable_del(m->table);
+    free(m);
+}
+
+/* cache of a function memo made, or NULL */
+lval* lmemo_find(lval* f) {
+    if (f->type == LVAL_MEMO) { return f; }
+    if (f->type != LVAL_FUN || f->builtin || f->body->count != 3
+        || f->body->cell[1]->type != LVAL_MEMO) {
+        return NULL;
+    }
+    return f->body->cell[1];
+}
+
+/* (memo f [max]), f with its results cached by argument list. the
+   result is a lambda passing its args and the cache to memo-call, so
+   it is called like any other, and recursive calls of f through its
+   name hit the cache once the name is bound to it */
+lval* builtin_memo(lenv* e, lval* a) {
+    LASSERT(a, a->count == 1 || a->count == 2,
+        "Function 'memo' passed incorrect number of arguments. "
+        "Got %i, Expected 1 or 2.", a->count);
+    LASSERT_TYPE("memo", a, 0, LVAL_FUN);
+    if (a->count == 2) {
+        LASSERT_TYPE("memo", a, 1, LVAL_NUM);
+        LASSERT(a, a->cell[1]->num > 0, "Function 'memo' passed a size of %li.",
+            a->cell[1]->num);
+    }
+
+    long max = a->count == 2 ? a->cell[1]->num : LMEMO_MAX;
+    lval* c = lval_memo(lval_pop(a, 0), max);
+    lval_del(a);
+
+    lval* formals = lval_add(lval_add(lval_qexpr(), lval_sym("&")), lval_sym("args"));
+    lval* body = lval_add(lval_qexpr(), lval_fun(builtin_memo_call));
+    lval_add(lval_add(body, c), lval_sym("args"));
+    return lval_lambda(lenv_global, formals, body);
+}
+
+/* (memo-call cache {args}), the cached result or a new one */
+lval* builtin_memo_call(lenv* e, lval* a) {
+    LASSERT_NUM("memo-call", a, 2);
+    LASSERT_TYPE("memo-call", a, 0, LVAL_MEMO);
+    LASSERT_TYPE("memo-call", a, 1, LVAL_QEXPR);
+
+    lmemo* m = a->cell[0]->memo;
+    lval* args = a->cell[1];
+    unsigned long h = lval_hash(args);
+    int i = ltable_find(m->table, args, h);
+    if (i >= 0) {
+        m->hits++;
+        lval* x = lval_ref(m->table->vals[i]);
+        /* now the most recent use */
+        lval* k = lval_ref(m->table->keys[i]);
+        ltable_remove(m->table, k);
+        ltable_put(m->table, k, lval_ref(x));
+        lval_del(a);
+        return x;
+    }
+
+    /* a slice of its own, binding takes it apart */
+    m->misses++;
+    lval* call = lval_copy(args);
+    call->type = LVAL_SEXPR;
+    lval* x = lval_apply(e, m->fn, call);
+    if (x->type == LVAL_ERR) { lval_del(a); return x; }
+
+    /* f may have filled the cache meanwhile */
+    if (m->table->count >= m->max && ltable_find(m->table, args, h) < 0) {
+        ltable_remove(m->table, m->table->keys[ltable_oldest(m->table)]);
+        m->evictions++;
+    }
+    ltable_put(m->table, lval_ref(args), lval_ref(x));
+    lval_del(a);
+    return x;
+}
+
+/* {{"hits" n} {"misses" n} {"evictions" n} {"entries" n} {"max" n}}
+   for a function made by memo */
+lval* builtin_memo_stats(lenv* e, lval* a) {
+    LASSERT_NUM("memo-stats", a, 1);
+    lval* c = lmemo_find(a->cell[0]);
+    LASSERT(a, c, "Function 'memo-stats' passed %s not made by memo.",
+        ltype_name(a->cell[0]->type));
+
+    lmemo* m = c->memo;
+    char* names[] = { "hits", "misses", "evictions", "entries", "max" };
+    long nums[] = { m->hits, m->misses, m->evictions, m->table->count, m->max };
+
+    lval* x = lval_qexpr();
+    for (int i = 0; i < 5; i++) {
+        lval_add(x, lval_add(lval_add(lval_qexpr(), lval_str(names[i])),
+            lval_num(nums[i])));
+    }
+    lval_del(a);
+    return x;
+}
+
+lval* lval_join(lval* x, lval* y) {
+    /* prepend a shorter x into y when y is ours to extend,
+       keeps (join (list a) rest) style recursion linear */
+    if (y->refs == 1 && x->count < y->count) {
+        lval_reserve(y, x->count, 0);
+        for (int i = x->count - 1; i >= 0; i--) {
+            *--y->cell = lval_ref(x->cell[i]);
+        }
+        y->buf->lo -= x->count;
+        y->count += x->count;
+        y->type = x->type;
+        lval_del(x);
+        return y;
+    }
+
+    /* otherwise append, y may be shared so reference its items */
+    x = lval_unshare(x);
+    lval_reserve(x, 0, y->count);
+    for (int i = 0; i < y->count; i++) {
+        x = lval_add(x, lval_ref(y->cell[i]));
+    }
+    
+    lval_del(y);
+    return x;
+}
+
+lval* lval_fun(lbuiltin func) {
+    lval* v = lval_new(LVAL_FUN);
+    v->builtin = func;
+    return v;
+}
+
+/* copy of the top node only, children are shared */
+lval* lval_copy(lval* v) {
+    lval* x = lval_new(v->type);
+
+    switch (v->type) {
+        /* copy func and num directly */
+        case LVAL_FUN:
+            if(v->builtin) {
+                x->builtin = v->builtin;
+            } else {
+                x->builtin = NULL;
+                x->env = lenv_copy(v->env);
+                x->formals = lval_ref(v->formals);
+                x->body = lval_ref(v->body);
+            }         
+        break;
+        case LVAL_NUM: x->num = v->num; break;
+        case LVAL_BIG: x->big = lbig_copy(v->big); break;
+        case LVAL_DBL: x->dbl = v->dbl; break;
+        case LVAL_MAP: x->table = ltable_copy(v->table); break;
+        /* nodes are shared */
+        case LVAL_VEC:
+            x->root = v->root;
+            x->tail = v->tail;
+            x->lo = v->lo;
+            x->end = v->end;
+            x->shift = v->shift;
+            if (x->root) { x->root->refs++; }
+            if (x->tail) { x->tail->refs++; }
+        break;
+        case LVAL_SEQ: x->seq = lseq_copy(v->seq); break;
+        /* the cache is shared */
+        case LVAL_MEMO: x->memo = v->memo; x->memo->refs++; break;
+        case LVAL_FOLD:
+            x->value = lval_ref(v->value);
+            x->expr = lval_ref(v->expr);
+            x->deps = lval_ref(v->deps);
+            x->epoch = v->epoch;
+        break;
+        /* copy strings with malloc and strcpy  */
+        case LVAL_ERR:
+            x->err = malloc(strlen(v->err) + 1);
+            strcpy(x->err, v->err); break;
+        /* symbols are interned, share the name */
+        case LVAL_SYM: x->sym = v->sym; break;
+        /* strings in a mapping share it */
+        case LVAL_STR:
+            x->map = v->map;
+            if (x->map) {
+                x->map->refs++;
+                x->str = v->str;
+            } else {
+                x->str = malloc(strlen(v->str) + 1);
+                strcpy(x->str, v->str);
+            }
+        break;
+        /* slice sharing the same cell store */
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            x->count = v->count;
+            x->cell = v->cell;
+            x->buf = v->buf;
+            x->code = NULL;
+            if (x->buf) { x->buf->refs++; }
+        break;            
+    }
+
+    return x;
+}
+
+/* v itself if we hold the only reference, otherwise a private copy;
+   lists also get a cell store of their own */
+lval* lval_unshare(lval* v) {
+    if (v->refs > 1) {
+        lval* x = lval_copy(v);
+        lval_del(v);
+        v = x;
+    }
+    if (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) { lval_own_cells(v); }
+    return v;
+}
+
+lenv* lenv_global = NULL;
+int ltop_form = 0;
+int lenv_epoch = 0;
+
+void lenv_del(lenv* e) {
+    /* captured envs live on with the lambdas that captured them */
+    if (--e->refs > 0) { return; }
+
+    for (int i = 0; i < e->cap; i++) {
+        if (e->syms[i]) { LSYM_BINDS(e->syms[i])--; lval_del(e->vals[i]); }
+    }
+    for (int i = e->old_pos; i < e->old_cap; i++) {
+        if (e->old_syms[i]) { LSYM_BINDS(e->old_syms[i])--; lval_del(e->old_vals[i]); }
+    }
+    if (e->lex) { lenv_del(e->lex); }
+    if (e == lenv_global) { lenv_global = NULL; }
+    if (e->gc_slot >= 0) { lgc_untrack(e); }
+    if (e->syms != e->inl_syms) { free(e->syms); free(e->vals); }
+    free(e->old_syms);
+    free(e->old_vals);
+    lpool_free(LPOOL_LENV, e);
+}
+
+/* hash of an interned symbol, keyed on its address */
+unsigned long lenv_hash(char* sym) {
+    unsigned long h = (unsigned long)sym;
+    return (h >> 4) * 2654435761u;
+}
+
+/* find slot of sym in a table, or the empty slot where it would go */
+int lenv_slot(char** syms, int cap, char* sym) {
+    int i = lenv_hash(sym) & (cap - 1);
+    while (syms[i] && syms[i] != sym) { i = (i + 1) & (cap - 1); }
+    return i;
+}
+
+/* find index of sym in e, or -1; *old set if found in resize table */
+int lenv_find(lenv* e, char* sym, int* old) {
+    *old = 0;
+
+    /* small env: linear scan of inline array */
+    if (e->syms == e->inl_syms) {
+        for (int i = 0; i < e->count; i++) {
+            if (e->syms[i] == sym) { return i; }
+        }
+        return -1;
+    }
+
+    int i = lenv_slot(e->syms, e->cap, sym);
+    if (e->syms[i]) { return i; }
+
+    /* not yet migrated out of the old table */
+    if (e->old_syms) {
+        i = lenv_slot(e->old_syms, e->old_cap, sym);
+        if (e->old_syms[i]) { *old = 1; return i; }
+    }
+    return -1;
+}
+
+/* move a few entries from the old table into the new one;
+   moved slots stay filled so old probe chains remain intact */
+void lenv_migrate(lenv* e, int n) {
+    while (e->old_syms && n > 0) {
+        if (e->old_pos == e->old_cap) {
+            free(e->old_syms); free(e->old_vals);
+            e->old_syms = NULL; e->old_vals = NULL;
+            e->old_cap = e->old_pos = 0;
+            break;
+        }
+        char* sym = e->old_syms[e->old_pos];
+        if (sym) {
+            int j = lenv_slot(e->syms, e->cap, sym);
+            e->syms[j] = sym;
+            e->vals[j] = e->old_vals[e->old_pos];
+        }
+        e->old_pos++;
+        n--;
+    }
+}
+
+/* switch to a table twice the size, old entries move over lazily */
+void lenv_grow(lenv* e) {
+    /* previous resize must be complete */
+    lenv_migrate(e, e->old_cap);
+
+    int cap = (e->syms == e->inl_syms) ? LENV_TABLE_MIN : e->cap * 2;
+    char** syms = calloc(cap, sizeof(char*));
+    lval** vals = calloc(cap, sizeof(lval*));
+
+    if (e->syms == e->inl_syms) {
+        /* inline entries are few, rehash them at once */
+        for (int i = 0; i < e->count; i++) {
+            int j = lenv_slot(syms, cap, e->syms[i]);
+            syms[j] = e->syms[i];
+            vals[j] = e->vals[i];
+        }
+    } else {
+        e->old_syms = e->syms;
+        e->old_vals = e->vals;
+        e->old_cap = e->cap;
+        e->old_pos = 0;
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+
+    e->syms = syms;
+    e->vals = vals;
+    e->cap = cap;
 }
 
 lval* lenv_get(lenv* e, lval* k) {
-    /* iterate through all environment items */
-    for (int i = 0; i < e->count; i++) {
-        /* check by sym string, return if match */
-        if(strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
+    int old;
+
+    /* bound in the global env at most, no need to walk the chain */
+    if (lenv_global && LSYM_BINDS(k->sym) <= 1) {
+        int i = lenv_find(lenv_global, k->sym, &old);
+        if (i >= 0) {
+            return lval_ref(old ? lenv_global->old_vals[i] : lenv_global->vals[i]);
+        }
+        if (LSYM_BINDS(k->sym) == 0) {
+            return lval_err("Unbound symbol '%s'", k->sym);
         }
     }
-    /* if no match in parent return error */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound symbol '%s'", k->sym);
-    }    
+
+    /* each env on the call chain, then the envs its lambda captured */
+    for (; e; e = e->par) {
+        for (lenv* l = e; l; l = l->lex) {
+            int i = lenv_find(l, k->sym, &old);
+            if (i >= 0) {
+                return lval_ref(old ? l->old_vals[i] : l->vals[i]);
+            }
+        }
+    }
+    return lval_err("Unbound symbol '%s'", k->sym);
 }
 
 void lenv_put(lenv* e, lval* k, lval* v) {
-    /* iterate through all environment items */
-    for (int i = 0; i < e->count; i++) {
-        /* if found, replace */
-        if(strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    /* if found, replace */
+    int old;
+    int i = lenv_find(e, k->sym, &old);
+    if (i >= 0) {
+        lval** vals = old ? e->old_vals : e->vals;
+        /* folds may have read the old value */
+        if (e == lenv_global) { lopt_epoch++; }
+        lval_del(vals[i]);
+        vals[i] = lval_ref(v);
+        return;
+    }
+
+    /* new entry - grow if inline array or table is full */
+    if (e->syms == e->inl_syms) {
+        if (e->count == LENV_INLINE) { lenv_grow(e); }
+    } else {
+        lenv_migrate(e, LENV_MIGRATE);
+        if ((e->count + 1) * 4 > e->cap * 3) { lenv_grow(e); }
     }
 
-    /* new entry - allocate space */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-    
     /* set value */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    i = (e->syms == e->inl_syms) ? e->count : lenv_slot(e->syms, e->cap, k->sym);
+    e->vals[i] = lval_ref(v);
+    e->syms[i] = k->sym;
+    e->count++;
+    LSYM_BINDS(k->sym)++;
 }
 
 lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+    return builtin_op(e, a, LMATH_ADD);
 }
 lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+    return builtin_op(e, a, LMATH_SUB);
 }
 lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+    return builtin_op(e, a, LMATH_MUL);
 }
 lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+    return builtin_op(e, a, LMATH_DIV);
+}
+
+/* every builtin and the interned name it was added under, so images
+   can refer to builtins by name */
+char** lbuiltin_names = NULL;
+lbuiltin* lbuiltin_funcs = NULL;
+int lbuiltin_count = 0;
+
+/* registered name of func, or NULL */
+char* lbuiltin_name(lbuiltin func) {
+    for (int i = 0; i < lbuiltin_count; i++) {
+        if (lbuiltin_funcs[i] == func) { return lbuiltin_names[i]; }
+    }
+    return NULL;
+}
+
+/* builtin registered under interned name, or NULL */
+lbuiltin lbuiltin_find(char* name) {
+    for (int i = 0; i < lbuiltin_count; i++) {
+        if (lbuiltin_names[i] == name) { return lbuiltin_funcs[i]; }
+    }
+    return NULL;
 }
 
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
     lval* k = lval_sym(name);
     lval* v = lval_fun(func);
     lenv_put(e, k, v);
+
+    if (!lbuiltin_find(k->sym)) {
+        lbuiltin_names = realloc(lbuiltin_names, sizeof(char*) * (lbuiltin_count + 1));
+        lbuiltin_funcs = realloc(lbuiltin_funcs, sizeof(lbuiltin) * (lbuiltin_count + 1));
+        lbuiltin_names[lbuiltin_count] = k->sym;
+        lbuiltin_funcs[lbuiltin_count++] = func;
+    }
     lval_del(k); lval_del(v);
 }
 
 void lenv_add_builtins(lenv* e) {
+    lenv_global = e;
+
     /* Var funcs */
     lenv_add_builtin(e, "\\", builtin_lambda);
+    lenv_add_builtin(e, "fun", builtin_fun);
     lenv_add_builtin(e, "def", builtin_def);
     lenv_add_builtin(e, "=", builtin_put);    
 
@@ -416,6 +2110,46 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "tail", builtin_tail);
     lenv_add_builtin(e, "eval", builtin_eval);
     lenv_add_builtin(e, "join", builtin_join);
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "filter", builtin_filter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "product", builtin_product);
+
+    /* Map funcs */
+    lenv_add_builtin(e, "map-new", builtin_map_new);
+    lenv_add_builtin(e, "map-get", builtin_map_get);
+    lenv_add_builtin(e, "map-put", builtin_map_put);
+    lenv_add_builtin(e, "map-del", builtin_map_del);
+    lenv_add_builtin(e, "map-keys", builtin_map_keys);
+
+    /* Vector funcs */
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "vec-nth", builtin_vec_nth);
+    lenv_add_builtin(e, "vec-len", builtin_vec_len);
+    lenv_add_builtin(e, "vec-push", builtin_vec_push);
+    lenv_add_builtin(e, "vec-set", builtin_vec_set);
+    lenv_add_builtin(e, "vec-pop", builtin_vec_pop);
+    lenv_add_builtin(e, "vec-rest", builtin_vec_rest);
+    lenv_add_builtin(e, "vec-list", builtin_vec_list);
+
+    /* Lazy funcs */
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "lazy-map", builtin_lazy_map);
+    lenv_add_builtin(e, "lazy-filter", builtin_lazy_filter);
+    lenv_add_builtin(e, "lazy-take", builtin_lazy_take);
+    lenv_add_builtin(e, "realize", builtin_realize);
+
+    /* Memo funcs */
+    lenv_add_builtin(e, "memo", builtin_memo);
+    lenv_add_builtin(e, "memo-call", builtin_memo_call);
+    lenv_add_builtin(e, "memo-stats", builtin_memo_stats);
 
     /* Math funcs */
     lenv_add_builtin(e, "+", builtin_add);
@@ -434,25 +2168,42 @@ void lenv_add_builtins(lenv* e) {
 
     /* String functions */
     lenv_add_builtin(e, "load", builtin_load);
+    lenv_add_builtin(e, "load-seq", builtin_load_seq);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
+    lenv_add_builtin(e, "show", builtin_show);
+    lenv_add_builtin(e, "serialize", builtin_serialize);
+    lenv_add_builtin(e, "deserialize", builtin_deserialize);
+
+    /* Runtime funcs */
+    lenv_add_builtin(e, "mem-stats", builtin_mem_stats);
+    lenv_add_builtin(e, "gc", builtin_gc);
+    lenv_add_builtin(e, "gc-stats", builtin_gc_stats);
 }
 
 char* ltype_name(int t) {
     switch (t) {
         case LVAL_FUN: return "Function";
         case LVAL_NUM: return "Number";
+        case LVAL_BIG: return "Bignum";
+        case LVAL_DBL: return "Double";
         case LVAL_ERR: return "Error";
         case LVAL_SYM: return "Symbol";
         case LVAL_STR: return "String";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_MAP: return "Map";
+        case LVAL_VEC: return "Vector";
+        case LVAL_SEQ: return "Sequence";
+        case LVAL_MEMO: return "Memo";
+        case LVAL_FOLD: return "Folded";
         default: return "Unknown";
     }
 }
 
-lval* builtin_var(lenv* e, lval* a, char* func) {
-    LASSERT_TYPE("def", a, 0, LVAL_QEXPR);
+lval* builtin_var(lenv* e, lval* a, int var) {
+    char* func = (var == LVAR_DEF) ? "def" : "=";
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
     
     /* first arg is a symbol list */
     lval* syms = a->cell[0];
@@ -474,11 +2225,11 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
     /* assign copies of values to symbols */
     for (int i = 0; i < syms->count; i++) {
         /* if 'def' define globally; if 'put' define locally */
-        if (strcmp(func, "def") == 0) {
+        if (var == LVAR_DEF) {
             lenv_def(e, syms->cell[i], a->cell[i+1]);
-        } 
-
-        if (strcmp(func, "=") == 0){
+        } else {
+            /* may shadow what a compiled closure reads from its captured env */
+            if (e->lex || e->refs > 1) { lenv_epoch++; }
             lenv_put(e, syms->cell[i], a->cell[i+1]);
         }        
     }
@@ -487,19 +2238,27 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
     return lval_sexpr();
 }
 
-lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+/* lambda created in env e, capturing it unless it is the global env */
+lval* lval_lambda(lenv* e, lval* formals, lval* body) {
+    lval* v = lval_new(LVAL_FUN);
 
     /* no builtin for lambdas */
     v->builtin = NULL;
 
     /* build new env */
     v->env = lenv_new();
+    if (e->par) {
+        e->refs++;
+        v->env->lex = e;
+    }
 
-    /* set formals and body */
+    /* set formals and body, folding bodies defined at the top level;
+       lambdas nested in them were folded along with them */
     v->formals = formals;
-    v->body = body;
+    v->body = (lopt_enabled && !e->par) ? lopt_body(formals, body) : body;
+
+    /* compiled once, later lambdas sharing the body reuse the code */
+    if (lvm_enabled) { lcode_compile(v->env->lex, formals, v->body); }
     return v;
 }
 
@@ -521,28 +2280,75 @@ lval* builtin_lambda(lenv* e, lval* a) {
     lval* body = lval_pop(a, 0);
     lval_del(a);
 
-    return lval_lambda(formals, body);
+    return lval_lambda(e, formals, body);
+}
+
+/* (fun {name formals...} {body}), builtin so the lambda captures the
+   caller's scope rather than fun's own */
+lval* builtin_fun(lenv* e, lval* a) {
+    LASSERT_NUM("fun", a, 2);
+    LASSERT_TYPE("fun", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("fun", a, 1, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("fun", a, 0);
+
+    /* 1st q-expr only symbols */
+    for (int i = 0; i < a->cell[0]->count; i++) {
+        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+            "Cannot define non-symbol. Got %s, Expected %s.",
+            ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+    }
+
+    /* name comes off the front, the rest are the formals */
+    lval* formals = lval_unshare(lval_pop(a, 0));
+    lval* body = lval_pop(a, 0);
+    lval_del(a);
+    lval* name = lval_pop(formals, 0);
+
+    lval* f = lval_lambda(e, formals, body);
+    lenv_def(e, name, f);
+    lval_del(name); lval_del(f);
+    return lval_sexpr();
 }
 
 lenv* lenv_new(void) {
-    lenv* e = malloc(sizeof(lenv));
+    lenv* e = lpool_alloc(LPOOL_LENV);
+    e->refs = 1;
     e->par = NULL;
+    e->lex = NULL;
     e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
+    e->cap = LENV_INLINE;
+    e->syms = e->inl_syms;
+    e->vals = e->inl_vals;
+    memset(e->inl_syms, 0, sizeof(e->inl_syms));
+    e->old_syms = NULL;
+    e->old_vals = NULL;
+    e->old_cap = 0;
+    e->old_pos = 0;
+    e->gc_slot = -1;
+    if (lgc_enabled) { lgc_track(e); }
     return e;
 }
 
 lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
+    lenv* n = lenv_new();
     n->par = e->par;
+    n->lex = e->lex;
+    if (n->lex) { n->lex->refs++; }
+
+    /* finish any pending resize so there is a single table to copy */
+    lenv_migrate(e, e->old_cap);
+
+    if (e->syms != e->inl_syms) {
+        n->cap = e->cap;
+        n->syms = calloc(n->cap, sizeof(char*));
+        n->vals = calloc(n->cap, sizeof(lval*));
+    }
     n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-    for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+    for (int i = 0; i < e->cap; i++) {
+        if (!e->syms[i]) { continue; }
+        n->syms[i] = e->syms[i];
+        n->vals[i] = lval_ref(e->vals[i]);
+        LSYM_BINDS(n->syms[i])++;
     }
     return n;    
 }
@@ -555,21 +2361,23 @@ void lenv_def(lenv* e, lval* k, lval* v) {
 }
 
 lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
+    return builtin_var(e, a, LVAR_DEF);
 }
 
 lval* builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
+    return builtin_var(e, a, LVAR_PUT);
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-    /* builtin: just return it */
-    if (f->builtin) { return f->builtin(e, a); }
-
+/* bind args a to the formals of lambda f, NULL once all formals are
+   bound, otherwise the error or partially applied function to return */
+lval* lval_bind(lenv* e, lval* f, lval* a) {
     /* record arg counts */
     int given = a->count;
     int total = f->formals->count;
 
+    /* formals are consumed as they bind */
+    f->formals = lval_unshare(f->formals);
+
     /* while args to process remain */
     while (a->count) {
         /* if no more formals to bind */
@@ -583,7 +2391,7 @@ lval* lval_call(lenv* e, lval* f, lval* a) {
         lval* sym = lval_pop(f->formals, 0);
 
         /* deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
+        if (sym->sym == lsym_amp) {
             /* '&' shouldn't hang */
             if (f->formals->count != 1) {
                 lval_del(a);
@@ -609,7 +2417,7 @@ lval* lval_call(lenv* e, lval* f, lval* a) {
     lval_del(a);
 
     /* if '&' reamins in formal list bind to empty list */
-    if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    if (f->formals->count > 0 && f->formals->cell[0]->sym == lsym_amp) {
         /* check validity */
         if (f->formals->count != 2) {
             return lval_err("Function format invalid. "
@@ -630,57 +2438,112 @@ lval* lval_call(lenv* e, lval* f, lval* a) {
 
     /* if all formals bound */
     if (f->formals->count == 0) {
-        /* set env parent to eval env */
-        f->env->par = e;
-
-        /* eval and return */
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+        return NULL;
     } else {
         /* return partially evaluated func */
         return lval_copy(f);
     }    
 }
 
+lval* lval_call(lenv* e, lval* f, lval* a) {
+    /* builtin: just return it */
+    if (f->builtin) { return f->builtin(e, a); }
+
+    lval* r = lval_bind(e, f, a);
+    if (r) { return r; }
+
+    /* set env parent to eval env */
+    f->env->par = e;
+
+    if (lvm_enabled && f->body->code) { return lvm_call(lval_ref(f)); }
+
+    /* eval and return */
+    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_ref(f->body)));
+}
+
 lval* builtin_gt(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">");
+    return builtin_ord(e, a, LORD_GT);
 }
 
 lval* builtin_lt(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<");
+    return builtin_ord(e, a, LORD_LT);
 }
 
 lval* builtin_ge(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">=");
+    return builtin_ord(e, a, LORD_GE);
 }
 
 lval* builtin_le(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<=");
+    return builtin_ord(e, a, LORD_LE);
 }
 
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
+char* lord_names[] = { ">", "<", ">=", "<=" };
 
-    int r;
-    if (strcmp(op, ">") == 0) { 
-        r = (a->cell[0]->num > a->cell[1]->num); 
+lval* builtin_ord(lenv* e, lval* a, int op) {
+    LASSERT_NUM(lord_names[op], a, 2);
+    for (int i = 0; i < 2; i++) {
+        LASSERT(a, lval_is_num(a->cell[i]),
+            "Function '%s' passed incorrect type for argument %i. Got %s, Expected %s.",
+            lord_names[op], i, ltype_name(a->cell[i]->type), ltype_name(LVAL_NUM));
     }
-    if (strcmp(op, "<") == 0) { 
-        r = (a->cell[0]->num < a->cell[1]->num); 
-    }
-    if (strcmp(op, ">=") == 0) { 
-        r = (a->cell[0]->num >= a->cell[1]->num); 
-    }
-    if (strcmp(op, "<=") == 0) { 
-        r = (a->cell[0]->num <= a->cell[1]->num); 
-    }
-    
+
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    int r = (x->type == LVAL_NUM && y->type == LVAL_NUM)
+        ? lord_test(op, x->num, y->num) : lnum_ord(op, x, y);
     lval_del(a);
     return lval_num(r);
 }
 
+int lord_test(int op, long x, long y) {
+    switch (op) {
+        case LORD_GT: return x > y;
+        case LORD_LT: return x < y;
+        case LORD_GE: return x >= y;
+        case LORD_LE: return x <= y;
+    }
+    return 0;
+}
+
+/* operator of an ordering builtin, or -1 */
+int lord_op(lbuiltin f) {
+    if (f == builtin_gt) { return LORD_GT; }
+    if (f == builtin_lt) { return LORD_LT; }
+    if (f == builtin_ge) { return LORD_GE; }
+    if (f == builtin_le) { return LORD_LE; }
+    return -1;
+}
+
+/* same names bound to equal values, in any order */
+int lenv_eq(lenv* x, lenv* y) {
+    if (x->count != y->count) { return 0; }
+
+    /* finish any pending resize so there is a single table to walk */
+    lenv_migrate(x, x->old_cap);
+    for (int i = 0; i < x->cap; i++) {
+        if (!x->syms[i]) { continue; }
+        int old;
+        int j = lenv_find(y, x->syms[i], &old);
+        if (j < 0) { return 0; }
+        if (!lval_eq(x->vals[i], old ? y->old_vals[j] : y->vals[j])) { return 0; }
+    }
+    return 1;
+}
+
 int lval_eq(lval* x, lval* y) {
+    /* folds are the expression they were folded from */
+    if (x->type == LVAL_FOLD) { return lval_eq(x->expr, y); }
+    if (y->type == LVAL_FOLD) { return lval_eq(x, y->expr); }
+    x = lval_written(x);
+    y = lval_written(y);
+
+    /* numbers by value, 1 and 1.0 are equal */
+    if (lval_is_num(x) && lval_is_num(y)
+        && (x->type != LVAL_NUM || y->type != LVAL_NUM)) {
+        if (x->type == LVAL_DBL || y->type == LVAL_DBL) { return lnum_dbl(x) == lnum_dbl(y); }
+        return lnum_cmp(x, y) == 0;
+    }
+
     /* types */
     if(x->type != y->type) { return 0; }
 
@@ -691,16 +2554,20 @@ int lval_eq(lval* x, lval* y) {
 
         /* strings */
         case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+        case LVAL_SYM: return (x->sym == y->sym);
         case LVAL_STR: return (strcmp(x->str, y->str) == 0);
 
-        /* funcs */
+        /* funcs - lambdas by source, the arguments already applied and
+           the env they captured, so closures over different values and
+           partial applications of different arguments differ */
         case LVAL_FUN:
             if (x->builtin || y->builtin) {
                 return x->builtin == y->builtin;
             } else {
-                return lval_eq(x->formals, y->formals)
-                && lval_eq(x->body, y->body);
+                return x->env->lex == y->env->lex
+                && lval_eq(x->formals, y->formals)
+                && lval_eq(x->body, y->body)
+                && lenv_eq(x->env, y->env);
             }
 
         /* lists - compare count and every individual element */
@@ -713,78 +2580,195 @@ int lval_eq(lval* x, lval* y) {
 
             return 1;
         break;
-            
+
+        /* maps - same keys bound to equal values, in any order */
+        case LVAL_MAP: {
+            ltable* t = x->table;
+            if (t->count != y->table->count) { return 0; }
+            for (int i = 0; i < t->used; i++) {
+                if (!t->keys[i]) { continue; }
+                int j = ltable_find(y->table, t->keys[i], t->hashes[i]);
+                if (j < 0 || !lval_eq(t->vals[i], y->table->vals[j])) { return 0; }
+            }
+            return 1;
+        }
+
+        case LVAL_VEC:
+            if (x->end - x->lo != y->end - y->lo) { return 0; }
+            for (int i = 0; i < x->end - x->lo; i++) {
+                if (!lval_eq(lvec_nth(x, i), lvec_nth(y, i))) { return 0; }
+            }
+            return 1;
+
+        /* sequences - made the same way */
+        case LVAL_SEQ: {
+            lseq* a = x->seq;
+            lseq* b = y->seq;
+            return a->kind == b->kind && a->from == b->from && a->to == b->to
+                && a->step == b->step && a->open == b->open
+                && (a->fn ? b->fn && lval_eq(a->fn, b->fn) : !b->fn)
+                && (a->src ? b->src && lval_eq(a->src, b->src) : !b->src);
+        }
+
+        /* caches - the same one */
+        case LVAL_MEMO: return x->memo == y->memo;
     }
 
     return 0;
 }
 
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT_NUM(op, a, 2);
+/* spread the bits of x over the word */
+static unsigned long lhash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return x;
+}
 
-    int r;
-    if(strcmp(op, "==") == 0) {
-        r = lval_eq(a->cell[0], a->cell[1]);
-    }
-    if(strcmp(op, "!=") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
+/* hash agreeing with lval_eq: values it finds equal hash the same */
+unsigned long lval_hash(lval* v) {
+    switch (v->type) {
+        /* numbers by value as a double, as lval_eq compares mixed ones;
+           a fixnum too big to convert exactly only risks a collision */
+        case LVAL_NUM:
+        case LVAL_BIG:
+        case LVAL_DBL: {
+            double d = lnum_dbl(v);
+            /* -0.0 == 0.0 */
+            if (d == 0) { d = 0; }
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return lhash_mix(bits);
+        }
+        case LVAL_ERR: return lsym_hash(v->err, strlen(v->err)) ^ 1;
+        case LVAL_SYM: return lenv_hash(v->sym);
+        case LVAL_STR: return lsym_hash(v->str, strlen(v->str));
+        case LVAL_FUN: {
+            if (v->builtin) { return lhash_mix((uintptr_t)v->builtin); }
+            unsigned long h = lval_hash(v->formals) * 31 + lval_hash(v->body);
+            h = h * 31 + (uintptr_t)v->env->lex;
+            /* applied arguments, in any order */
+            lenv* e = v->env;
+            lenv_migrate(e, e->old_cap);
+            for (int i = 0; i < e->cap; i++) {
+                if (!e->syms[i]) { continue; }
+                h += lhash_mix(lenv_hash(e->syms[i]) * 31 + lval_hash(e->vals[i]));
+            }
+            return lhash_mix(h);
+        }
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            v = lval_written(v);
+            unsigned long h = v->type;
+            for (int i = 0; i < v->count; i++) { h = h * 31 + lval_hash(v->cell[i]); }
+            return lhash_mix(h);
+        }
+        /* order independent, equal maps may differ in order */
+        case LVAL_MAP: {
+            ltable* t = v->table;
+            unsigned long h = LVAL_MAP;
+            for (int i = 0; i < t->used; i++) {
+                if (!t->keys[i]) { continue; }
+                h += lhash_mix(t->hashes[i] * 31 + lval_hash(t->vals[i]));
+            }
+            return h;
+        }
+        case LVAL_VEC: {
+            unsigned long h = v->type;
+            for (int i = 0; i < v->end - v->lo; i++) { h = h * 31 + lval_hash(lvec_nth(v, i)); }
+            return lhash_mix(h);
+        }
+        case LVAL_SEQ: {
+            lseq* s = v->seq;
+            unsigned long h = s->kind * 31 + s->from;
+            h = h * 31 + s->to;
+            h = h * 31 + s->step;
+            if (s->fn) { h = h * 31 + lval_hash(s->fn); }
+            if (s->src) { h = h * 31 + lval_hash(s->src); }
+            return lhash_mix(h);
+        }
+        case LVAL_MEMO: return lhash_mix((unsigned long)v->memo);
+        case LVAL_FOLD: return lval_hash(v->expr);
     }
+    return 0;
+}
+
+lval* builtin_cmp(lenv* e, lval* a, int op) {
+    LASSERT_NUM(op == LCMP_EQ ? "==" : "!=", a, 2);
+
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    if (op == LCMP_NE) { r = !r; }
     lval_del(a);
     return lval_num(r); 
 }
 
 lval* builtin_eq(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "==");
+    return builtin_cmp(e, a, LCMP_EQ);
 }
 
 lval* builtin_ne(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "!=");
+    return builtin_cmp(e, a, LCMP_NE);
 }
 
-lval* builtin_if(lenv* e, lval* a) {
+/* the branch if would evaluate, or an error */
+lval* builtin_if_expr(lval* a) {
     LASSERT_NUM("if", a, 3);
     LASSERT_TYPE("if", a, 0, LVAL_NUM);
     LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
     
-    /* mark both exprs as evaluable */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
+    /* if condition is true evaluate first expr */
+    lval* x = lval_unshare(lval_pop(a, a->cell[0]->num ? 1 : 2));
 
-    if (a->cell[0]->num) {
-        /* if condition is true evaluate first expr */
-        x = lval_eval(e, lval_pop(a, 1));
-    } else {
-        x = lval_eval(e, lval_pop(a, 2));
-    }
+    /* mark expr as evaluable */
+    x->type = LVAL_SEXPR;
 
     /* cleanup args list */
     lval_del(a);
     return x;
 }
 
+lval* builtin_if(lenv* e, lval* a) {
+    return lval_eval(e, builtin_if_expr(a));
+}
+
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
+    lval* v = lval_new(LVAL_STR);
     v->str = malloc(strlen(s) + 1);
+    v->map = NULL;
     strcpy(v->str, s);
     return v;
 }
 
 lval* builtin_print(lenv* e, lval* a) {
     /* print args + space */
+    lout* o = lout_std();
     for (int i = 0; i < a->count; i++) {
-        lval_print(a->cell[i]); putchar(' ');
+        lval_write(o, a->cell[i]); lout_char(o, ' ');
     }
     
     /* print \n and delete args */
-    putchar('\n');
+    lout_char(o, '\n');
+    lout_flush(o);
     lval_del(a);
 
     return lval_sexpr();
 }
 
+/* printed form of the arg as a string */
+lval* builtin_show(lenv* e, lval* a) {
+    LASSERT_NUM("show", a, 1);
+
+    lout o = lout_string();
+    lval_write(&o, a->cell[0]);
+    lval_del(a);
+
+    lval* x = lval_new(LVAL_STR);
+    x->str = lout_take(&o);
+    x->map = NULL;
+    return x;
+}
+
 lval* builtin_error(lenv* e, lval* a) {
     LASSERT_NUM("error", a, 1);
     LASSERT_TYPE("error", a, 0, LVAL_STR);
@@ -797,13 +2781,155 @@ lval* builtin_error(lenv* e, lval* a) {
     return err;
 }
 
-lval* lval_read_expr(char* s, int* i, char end) {
+/* character classes for the reader and printer, set up on first use */
+unsigned char lchar_class[256];
+
+void lchar_init(void) {
+    if (lchar_class['a']) { return; }
+    for (char* c = " \t\v\r\n"; *c; c++) { lchar_class[(unsigned char)*c] |= LCHAR_SPACE; }
+    for (char* c = "abcdefghijklmnopqrstuvwxyz"
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+            "0123456789_+-*\\/=<>!&."; *c; c++) {
+        lchar_class[(unsigned char)*c] |= LCHAR_SYM;
+    }
+    for (char* c = "0123456789"; *c; c++) { lchar_class[(unsigned char)*c] |= LCHAR_DIGIT; }
+    for (char* c = lval_str_escapable; *c; c++) { lchar_class[(unsigned char)*c] |= LCHAR_ESCAPE; }
+}
+
+/* reader over the len chars at s */
+lreader lreader_new(char* s, long len) {
+    lchar_init();
+    lreader r = { s, len, 0, NULL, 0, NULL };
+    return r;
+}
+
+/* reader pulling from f as it goes, see lreader_fill */
+lreader lreader_file(FILE* f) {
+    lchar_init();
+    lreader r = { malloc(LREADER_CHUNK), 0, 0, f, LREADER_CHUNK, NULL };
+    return r;
+}
+
+/* reader over a mapped file, holding a reference to it */
+lreader lreader_map(lmap* m) {
+    lchar_init();
+    m->refs++;
+    lreader r = { m->s, m->len, 0, NULL, 0, m };
+    return r;
+}
+
+/* map all of f if it is a regular file, else NULL; pages are copy on
+   write so strings can be terminated in place */
+lmap* lmap_open(FILE* f) {
+#ifdef _WIN32
+    return NULL;
+#else
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return NULL;
+    }
+
+    char* s = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+    if (s == MAP_FAILED) { return NULL; }
+    madvise(s, st.st_size, MADV_SEQUENTIAL);
+
+    lmap* m = malloc(sizeof(lmap));
+    m->refs = 1;
+    m->s = s;
+    m->len = st.st_size;
+    m->kept = 0;
+    m->page = sysconf(_SC_PAGESIZE);
+    return m;
+#endif
+}
+
+/* drop the pages before pos that no string points into, they are
+   clean and read back from the file if ever touched again */
+void lmap_release(lmap* m, long pos) {
+#ifndef _WIN32
+    long from = (m->kept + m->page - 1) / m->page * m->page;
+    long to = pos / m->page * m->page;
+    if (to - from >= LREADER_CHUNK) {
+        madvise(m->s + from, to - from, MADV_DONTNEED);
+        m->kept = to;
+    }
+#endif
+}
+
+void lmap_del(lmap* m) {
+    if (--m->refs > 0) { return; }
+#ifndef _WIN32
+    munmap(m->s, m->len);
+#endif
+    free(m);
+}
+
+void lreader_del(lreader* r) {
+    if (r->f) { free(r->s); }
+    if (r->map) { lmap_del(r->map); }
+}
+
+/* read more of the file until there is a char at pos, false at the end;
+   the buffer only grows while a form is being read */
+int lreader_fill(lreader* r) {
+    while (r->f && r->pos >= r->len) {
+        if (r->len == r->cap) {
+            r->cap *= 2;
+            r->s = realloc(r->s, r->cap);
+        }
+        size_t n = fread(r->s + r->len, 1, r->cap - r->len, r->f);
+        if (n == 0) { return 0; }
+        r->len += n;
+    }
+    return r->pos < r->len;
+}
+
+/* next top level form, NULL at the end of input */
+lval* lreader_next(lreader* r) {
+    lreader_skip(r);
+
+    /* drop what has been read once it is half the buffer, the next form
+       then starts the buffer */
+    if (r->f && r->pos > r->cap / 2) {
+        memmove(r->s, r->s + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+    }
+
+    if (r->map) { lmap_release(r->map, r->pos); }
+
+    if (!LREADER_MORE(r)) { return NULL; }
+    return lval_read(r);
+}
+
+/* skip whitespace and comments */
+void lreader_skip(lreader* r) {
+    while (LREADER_MORE(r)) {
+        char c = r->s[r->pos];
+        if (c == ';') {
+            /* comment may go on past what is buffered */
+            char* nl;
+            while (!(nl = memchr(r->s + r->pos, '\n', r->len - r->pos))) {
+                r->pos = r->len;
+                if (!lreader_fill(r)) { return; }
+            }
+            r->pos = nl - r->s + 1;
+        } else if (lchar_class[(unsigned char)c] & LCHAR_SPACE) {
+            r->pos++;
+        } else {
+            break;
+        }
+    }
+}
+
+lval* lval_read_expr(lreader* r, char end) {
     /* create new seqxp or qexpr */
     lval* x = (end == '}') ? lval_qexpr() : lval_sexpr();
 
-    /* while not end char keep reading */
-    while (s[*i] != end) {
-        lval* y = lval_read(s, i);
+    /* while not end char keep reading, '\0' reads to the end */
+    lreader_skip(r);
+    while (LREADER_PEEK(r) != end) {
+        lval* y = lval_read(r);
         /* handle error*/
         if (y->type == LVAL_ERR) {
             lval_del(x);
@@ -814,106 +2940,140 @@ lval* lval_read_expr(char* s, int* i, char end) {
     }
 
     /* move past end char */
-    (*i)++;
+    r->pos++;
 
     return x;
 }
 
-lval* lval_read(char* s, int* i) {
+lval* lval_read(lreader* r) {
     /* skip whitespace, comments, etc. */
-    while (strchr(" \t\v\r\n;", s[*i]) && s[*i] != '\0') {
-        if (s[*i] == ';') {
-            while (s[*i] != '\n' && s[*i] != '\n') { (*i)++; }
-        }
-        (*i)++;
-    }
+    lreader_skip(r);
 
     lval* x = NULL;
+    char c = LREADER_PEEK(r);
 
     /* if end of input, error */
-    if (s[*i] == '\0') {
+    if (!LREADER_MORE(r)) {
         return lval_err("Unexpected end of input");
     }
 
     /* if '(', read s-expr */
-    else if (s[*i] == '(') {
-        (*i)++;
-        x = lval_read_expr(s, i, ')');
+    else if (c == '(') {
+        r->pos++;
+        x = lval_read_expr(r, ')');
     }
 
     /* if '{', read s-expr */
-    else if (s[*i] == '{') {
-        (*i)++;
-        x = lval_read_expr(s, i, '}');
+    else if (c == '{') {
+        r->pos++;
+        x = lval_read_expr(r, '}');
+    }
+
+    /* '#{' -> read map literal of keys and values, '#[' -> vector */
+    else if (c == '#') {
+        r->pos++;
+        char d = LREADER_PEEK(r);
+        if (d != '{' && d != '[') {
+            return lval_err("Unexpected character %c", c);
+        }
+        r->pos++;
+        lval* l = lval_read_expr(r, d == '{' ? '}' : ']');
+        if (l->type == LVAL_ERR) { return l; }
+        if (d == '[') {
+            x = lval_vec_list(l);
+        } else if (l->count % 2) {
+            lval_del(l);
+            return lval_err("Map literal needs a value for every key");
+        } else {
+            x = lval_map();
+            ltable_rehash(x->table, l->count / 2);
+            for (int i = 0; i < l->count; i += 2) {
+                ltable_put(x->table, lval_ref(l->cell[i]), lval_ref(l->cell[i + 1]));
+            }
+        }
+        lval_del(l);
     }
 
     /* symbol part -> read symbol */
-    else if (strchr(
-            "abcdefghijklmnopqrstuvwxyz"
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "0123456789_+-*\\/=<>!&", s[*i])) {
-        x = lval_read_sym(s, i);
+    else if (lchar_class[(unsigned char)c] & LCHAR_SYM) {
+        x = lval_read_sym(r);
     }
 
     /* '"' -> read string" */
-    else if (strchr("\"", s[*i])) {
-        x = lval_read_str(s, i);
+    else if (c == '"') {
+        x = lval_read_str(r);
     }
 
     /* if unexpected char*/
     else {
-        x = lval_err("Unexpected character %c", s[*i]);
+        x = lval_err("Unexpected character %c", c);
     }
 
     /* skip whitespace, comments, etc. */
-    while (strchr(" \t\v\r\n;", s[*i]) && s[*i] != '\0') {
-        if (s[*i] == ';') {
-            while (s[*i] != '\n' && s[*i] != '\n') { (*i)++; }
-        }
-        (*i)++;
-    }
+    lreader_skip(r);
 
     return x;
 }
 
-lval* lval_read_sym(char* s, int* i) {
-    /* alloc empty string */
-    char* part = calloc(1,1);
-
-    /* valid chars only */
-    while (strchr(
-            "abcdefghijklmnopqrstuvwxyz"
-            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "0123456789_+-*\\/=<>!&", s[*i]) && s[*i] != '\0') {
-        
-        /* append char to string end */
-        part = realloc(part, strlen(part)+2);
-        part[strlen(part)+1] = '\0';
-        part[strlen(part)+0] = s[*i];
-        (*i)++;
-    }
-        
-    /* check if number */
-    int is_num = strchr("-0123456789", part[0]) != NULL;
-    for (int i = 0; i < strlen(part); i++) {
-        if (strchr("0123456789", part[i]) == NULL) { is_num = 0; break; }
+lval* lval_read_sym(lreader* r) {
+    /* token is the run of symbol chars, read in place */
+    long start = r->pos;
+    while (LREADER_MORE(r) && (lchar_class[(unsigned char)r->s[r->pos]] & LCHAR_SYM)) {
+        r->pos++;
     }
-        
-    /* add symbol or number as lval */
-    lval* x = NULL;
-    if (is_num) {
-        errno = 0;
-        long v = strtol(part, NULL, 10);
-        x = (errno != ERANGE) ? lval_num(v) : lval_err("Invalid Number %s", part);
-    } else {
-        x = lval_sym(part);
+    char* part = r->s + start;
+    int n = r->pos - start;
+
+    int syntax = lnum_syntax(part, n);
+    if (syntax == LVAL_SYM) { return lsym_intern_n(part, n); }
+
+    if (syntax == LVAL_DBL) {
+        /* token is not terminated in place */
+        char buf[64];
+        char* s = n < (int)sizeof(buf) ? buf : malloc(n + 1);
+        memcpy(s, part, n);
+        s[n] = '\0';
+        double d = strtod(s, NULL);
+        lval* x = isfinite(d) ? lval_dbl(d) : lval_err("Number %s out of range", s);
+        if (s != buf) { free(s); }
+        return x;
     }
 
-    /* free temp string */
-    free(part);
+    /* integer, accumulated towards the sign so LONG_MIN reads too */
+    int neg = (part[0] == '-');
+    long v = 0;
+    for (int i = neg; i < n; i++) {
+        int d = part[i] - '0';
+        if (__builtin_mul_overflow(v, 10, &v)
+            || (neg ? __builtin_sub_overflow(v, d, &v) : __builtin_add_overflow(v, d, &v))) {
+            return lval_big(lbig_read(part, n));
+        }
+    }
+    return lval_num(v);
+}
 
-    /* return updated position in input */
-    return x;
+/* what the n chars at s read as: LVAL_NUM for digits with an optional
+   leading '-', LVAL_DBL if they go on with a fraction and/or exponent,
+   otherwise LVAL_SYM */
+int lnum_syntax(char* s, int n) {
+    int i = (n > 1 && s[0] == '-');
+    int digits = i;
+    while (i < n && (lchar_class[(unsigned char)s[i]] & LCHAR_DIGIT)) { i++; }
+    if (i == digits) { return LVAL_SYM; }
+    if (i == n) { return LVAL_NUM; }
+
+    if (s[i] == '.') {
+        i++;
+        while (i < n && (lchar_class[(unsigned char)s[i]] & LCHAR_DIGIT)) { i++; }
+    }
+    if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        if (i < n && (s[i] == '+' || s[i] == '-')) { i++; }
+        int exp = i;
+        while (i < n && (lchar_class[(unsigned char)s[i]] & LCHAR_DIGIT)) { i++; }
+        if (i == exp) { return LVAL_SYM; }
+    }
+    return i == n ? LVAL_DBL : LVAL_SYM;
 }
 
 char lval_str_unescape(char x) {
@@ -951,62 +3111,90 @@ char* lval_str_escape(char x) {
     return "";
 }
 
-lval* lval_read_str(char* s, int* i) {
-    /* string alloc */
-    char* part = calloc(1,1);
-
+lval* lval_read_str(lreader* r) {
     /* skip initial '"' char */
-    (*i)++;
-    while (s[*i] != '"') {
-        char c = s[*i];
-
-        /* check for unterminated string literals */
-        if (c == '\0') {
-            free(part);
-            return lval_err("Unexpected end of input");
-        }
+    long start = ++r->pos;
+
+    /* find the closing '"', the string is at most that long */
+    int escaped = 0;
+    while (LREADER_MORE(r)) {
+        /* plain chars up to the end of what is buffered */
+        char* q = r->s + r->pos;
+        char* end = r->s + r->len;
+        while (q < end && *q != '"' && *q != '\\') { q++; }
+        r->pos = q - r->s;
+
+        if (q == end) { continue; }
+        if (*q == '"') { break; }
+        escaped = 1;
+        r->pos += 2;
+    }
+
+    /* check for unterminated string literals */
+    if (!LREADER_MORE(r)) {
+        return lval_err("Unexpected end of input");
+    }
+
+    /* strings of a page or more in a mapped file are unescaped and
+       terminated in place, pointing into it; a shorter one would cost a
+       whole copied page, so it gets its own copy like any other */
+    lmap* m = (r->map && r->pos - start >= r->map->page) ? r->map : NULL;
+    char* part = m ? r->s + start : malloc(r->pos - start + 1);
+    long n = 0;
+    if (!escaped) {
+        n = r->pos - start;
+        if (!m) { memcpy(part, r->s + start, n); }
+    }
+    for (long i = start + n; i < r->pos; i++) {
+        char c = r->s[i];
 
         /* unescape */
         if (c == '\\') {
-            (*i)++;
+            i++;
             /* check next char */
-            if (strchr(lval_str_unescapable, s[*i])) {
-                c = lval_str_unescape(s[*i]);
+            if (r->s[i] && strchr(lval_str_unescapable, r->s[i])) {
+                c = lval_str_unescape(r->s[i]);
             } else {
-                free(part);
-                return lval_err("Invalid escape sequence \\%c", s[*i]);
+                lval* err = lval_err("Invalid escape sequence \\%c", r->s[i]);
+                if (!m) { free(part); }
+                return err;
             }
         }
-
-        /* append char to string */
-        part = realloc(part, strlen(part)+2);
-        part[strlen(part)+1] = '\0';
-        part[strlen(part)+0] = c;
-        (*i)++;
+        /* in place, chars before the first escape stay where they are */
+        if (part + n != r->s + i) { part[n] = c; }
+        n++;
     }
-    /* skip final '"' char */
-    (*i)++;
+    part[n] = '\0';
 
-    lval* x = lval_str(part);
-
-    free(part);
-
-    return x;    
+    /* skip final '"' char */
+    r->pos++;
+
+    /* string takes over the buffer */
+    lval* x = lval_new(LVAL_STR);
+    x->str = part;
+    x->map = m;
+    if (m) {
+        m->refs++;
+        m->kept = r->pos;
+    }
+    return x;
 }
 
-void lval_print_str(lval* v) {
-    putchar('"');
-    /* loop over string chars */
-    for (int i = 0; i < strlen(v->str); i++) {
-        if (strchr(lval_str_escapable, v->str[i])) {
-            /* escape escapable chars */
-            printf("%s", lval_str_escape(v->str[i]));
-        } else {
-            /* otherwise print as is */
-            putchar(v->str[i]);
+void lval_write_str(lout* o, lval* v) {
+    lchar_init();
+    lout_char(o, '"');
+    /* runs of plain chars go out in one write, escapable ones escaped */
+    char* run = v->str;
+    char* s = v->str;
+    for (; *s; s++) {
+        if (lchar_class[(unsigned char)*s] & LCHAR_ESCAPE) {
+            lout_write(o, run, s - run);
+            lout_write(o, lval_str_escape(*s), 2);
+            run = s + 1;
         }
     }
-    putchar('"');
+    lout_write(o, run, s - run);
+    lout_char(o, '"');
 }
 
 lval* builtin_load(lenv* e, lval* a) {
@@ -1021,32 +3209,160 @@ lval* builtin_load(lenv* e, lval* a) {
         return err;
     }
 
-    /* read file */
-    fseek(f, 0, SEEK_END);
-    long length = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    char* input = calloc(length+1, 1);
-    fread(input, 1, length, f);
+    lval_del(a);
+    lval* x = lval_load(e, f);
     fclose(f);
+    return x;
+}
 
-    /* read from input to create sexpr */
-    int pos = 0;
-    lval* expr = lval_read_expr(input, &pos, '\0');
-    free(input);
+/* the forms of a file as a lazy sequence, read as they are pulled and
+   not evaluated */
+lval* builtin_load_seq(lenv* e, lval* a) {
+    LASSERT_NUM("load-seq", a, 1);
+    LASSERT_TYPE("load-seq", a, 0, LVAL_STR);
 
-    /* evaluate all expression contained in sexpr */
-    if (expr->type != LVAL_ERR) {
-        while (expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
+    return lval_seq(LSEQ_FORMS, NULL, lval_take(a, 0));
+}
+
+/* read and evaluate the forms in f one at a time, printing errors;
+   regular files are mapped and read in place, anything else streamed */
+lval* lval_load(lenv* e, FILE* f) {
+    /* forms are top level unless the load runs inside one */
+    int top = !ltop_form;
+
+    lmap* m = lmap_open(f);
+    lreader r = m ? lreader_map(m) : lreader_file(f);
+    if (m) { lmap_del(m); }
+
+    lval* expr;
+    while ((expr = lreader_next(&r))) {
+        /* a read error ends the load */
+        if (expr->type == LVAL_ERR) {
+            lval_println(expr);
+            lval_del(expr);
+            break;
         }
+
+        if (top) { ltop_form = 1; }
+        lval* x = lval_eval(e, expr);
+        if (x->type == LVAL_ERR) { lval_println(x); }
+        lval_del(x);
+        if (top) { lgc_maybe(); ltop_form = 0; }
+    }
+
+    lreader_del(&r);
+    return lval_sexpr();
+}
+
+/* write the value image of the 2nd arg to the file named by the 1st */
+lval* builtin_serialize(lenv* e, lval* a) {
+    LASSERT_NUM("serialize", a, 2);
+    LASSERT_TYPE("serialize", a, 0, LVAL_STR);
+
+    FILE* f = fopen(a->cell[0]->str, "wb");
+    if (f == NULL) {
+        lval* err = lval_err("Could not write %s", a->cell[0]->str);
+        lval_del(a);
+        return err;
+    }
+
+    limage m = limage_new();
+    limage_header(&m, LIMAGE_VALUE);
+    limage_val(&m, a->cell[1]);
+    int ok = fwrite(m.s, 1, m.len, f) == (size_t)m.len;
+    ok = (fclose(f) == 0) && ok;
+    free(m.s);
+    limage_free(&m);
+
+    lval* x = ok ? lval_sexpr() : lval_err("Could not write %s", a->cell[0]->str);
+    lval_del(a);
+    return x;
+}
+
+/* value in the image file named by the arg */
+lval* builtin_deserialize(lenv* e, lval* a) {
+    LASSERT_NUM("deserialize", a, 1);
+    LASSERT_TYPE("deserialize", a, 0, LVAL_STR);
+
+    FILE* f = fopen(a->cell[0]->str, "rb");
+    if (f == NULL) {
+        lval* err = lval_err("Could not read %s", a->cell[0]->str);
+        lval_del(a);
+        return err;
+    }
+    lval_del(a);
+
+    /* read in place from a mapping, or read it all if it can't be mapped */
+    lval* x;
+    lmap* m = lmap_open(f);
+    if (m) {
+        x = limage_load_value((unsigned char*)m->s, m->len);
+        lmap_del(m);
     } else {
-        lval_println(expr);
+        long len = 0;
+        long cap = LREADER_CHUNK;
+        unsigned char* s = malloc(cap);
+        size_t n;
+        while ((n = fread(s + len, 1, cap - len, f)) > 0) {
+            len += n;
+            if (len == cap) { s = realloc(s, cap *= 2); }
+        }
+        x = limage_load_value(s, len);
+        free(s);
     }
+    fclose(f);
+    return x;
+}
 
-    lval_del(expr);
+/* allocator stats as {{"pool" live peak allocs} ... {"Type" allocs} ...},
+   args are ignored so it can be called as (mem-stats ()) */
+lval* builtin_mem_stats(lenv* e, lval* a) {
     lval_del(a);
 
+    lval* x = lval_qexpr();
+    for (int i = 0; i < LPOOL_COUNT; i++) {
+        if (!lpools[i].name) { continue; }
+        lval* row = lval_add(lval_qexpr(), lval_str(lpools[i].name));
+        lval_add(row, lval_num(lpools[i].live));
+        lval_add(row, lval_num(lpools[i].peak));
+        lval_add(row, lval_num(lpools[i].allocs));
+        lval_add(x, row);
+    }
+    lval_add(x, lval_add(lval_add(lval_qexpr(), lval_str("cells-large")),
+        lval_num(lwords_large_live)));
+    lval_add(x, lval_add(lval_add(lval_qexpr(), lval_str("sys-calls")),
+        lval_num(lalloc_sys_calls)));
+
+    for (int t = 0; t < LVAL_TYPE_COUNT; t++) {
+        lval_add(x, lval_add(lval_add(lval_qexpr(), lval_str(ltype_name(t))),
+            lval_num(ltype_allocs[t])));
+    }
+    return x;
+}
+
+/* collect cycles once the current top level form is done, args are
+   ignored so it can be called as (gc ()) */
+lval* builtin_gc(lenv* e, lval* a) {
+    lval_del(a);
+    if (!lgc_enabled) { return lval_err("Cycle collection is off, run with --gc."); }
+    lgc.pending = 1;
     return lval_sexpr();
+}
+
+/* collector stats as {{"name" n} ...}, pauses in microseconds, args
+   are ignored */
+lval* builtin_gc_stats(lenv* e, lval* a) {
+    lval_del(a);
+
+    char* names[] = { "collections", "pause-last", "pause-max", "pause-total",
+        "scanned", "collected", "tracked" };
+    long nums[] = { lgc.collections, lgc.pause_last, lgc.pause_max, lgc.pause_total,
+        lgc.scanned, lgc.collected, lgc_nenvs };
+
+    lval* x = lval_qexpr();
+    for (int i = 0; i < 7; i++) {
+        lval_add(x, lval_add(lval_add(lval_qexpr(), lval_str(names[i])),
+            lval_num(nums[i])));
+    }
+    return x;
 }
\ No newline at end of file
@@ -23,101 +23,473 @@
 
 struct lval;
 struct lenv;
+struct lcells;
+struct lcode;
+struct lmap;
+struct lbig;
+struct ltable;
+struct lvnode;
+struct lseq;
+struct lmemo;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcells lcells;
+typedef struct lcode lcode;
+typedef struct lmap lmap;
+typedef struct lbig lbig;
+typedef struct ltable ltable;
+typedef struct lvnode lvnode;
+typedef struct lseq lseq;
+typedef struct lmemo lmemo;
 
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+    LVAL_BIG, LVAL_DBL, LVAL_MAP,
+    LVAL_VEC, LVAL_SEQ, LVAL_MEMO, LVAL_FOLD, LVAL_TYPE_COUNT };
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* reference count of values that are never freed */
+#define LVAL_IMMORTAL (1 << 30)
+
+/* small numbers are preallocated and shared */
+#define LNUM_SMALL_MIN -128
+#define LNUM_SMALL_MAX 1024
+
 struct lval {
     int type;
+    int refs;
+
+    /* fields in use depend on type */
+    union {
+        /* basic, num is a fixnum; integers past a long are bignums (see
+           bignum.h) */
+        long num;
+        lbig* big;
+        double dbl;
+        char* err;
+        char* sym; /* interned, compare by pointer */
+        ltable* table; /* map */
+        lseq* seq; /* lazy sequence */
+        lmemo* memo; /* cache of a memoized function */
+
+        /* string, map is the loaded file str points into or NULL if
+           str is malloced */
+        struct {
+            char* str;
+            lmap* map;
+        };
+
+        /* vector, items [lo, end) of the trie at root and the tail leaf
+           (see vector.h) */
+        struct {
+            lvnode* root;
+            lvnode* tail;
+            int lo;
+            int end;
+            int shift;
+        };
+
+        /* folded expression, value stands for expr while the globals
+           in deps are bound as they were at epoch (see opt.h) */
+        struct {
+            lval* value;
+            lval* expr;
+            lval* deps;
+            int epoch;
+        };
+
+        /* function */
+        struct {
+            lbuiltin builtin;
+            lenv* env;
+            lval* formals;
+            lval* body;
+        };
+
+        /* expression, cell points at the first item of a slice of buf;
+           code is the compiled form of a lambda body (see vm.h) */
+        struct {
+            int count;
+            lval** cell;
+            lcells* buf;
+            lcode* code;
+        };
+    };
+};
+
+/* growable backing store for expression cells, shared between slices
+   (see lval_copy) and owning the items in [lo, hi) */
+struct lcells {
+    int refs;
+    int cap;
+    int lo;
+    int hi;
+    lval* items[];
+};
 
-    /* basic */
-    long num;    
-    char* err;
-    char* sym;
-    char* str;
-
-    /* function */
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
-    
-    /* expression */
+/* hash table of a map; entries stay in insertion order with deleted
+   ones left as NULL keys until the next rehash, and index maps hashes
+   to entry numbers by open addressing, -1 for an empty slot */
+struct ltable {
+    lval** keys;
+    lval** vals;
+    unsigned long* hashes;
     int count;
-    lval** cell;
+    int used;
+    int cap;
+    int* index;
+    int icap;
+    /* no live entry before first */
+    int first;
+};
+
+#define LTABLE_MIN 4
+
+/* result cache of a function made by memo, shared by copies of the
+   value holding it; entries map argument lists to results, oldest
+   use first, and the oldest goes once there are max */
+struct lmemo {
+    int refs;
+    lval* fn;
+    ltable* table;
+    long max;
+    long hits;
+    long misses;
+    long evictions;
+};
+
+#define LMEMO_MAX 65536
+
+/* kinds of lazy sequence */
+enum { LSEQ_RANGE, LSEQ_MAP, LSEQ_FILTER, LSEQ_TAKE, LSEQ_FORMS };
+
+/* lazy sequence, how to make its items rather than the items; each
+   consumer pulls them through an lsiter of its own, so nothing is
+   computed before it is asked for or kept after. src is the list,
+   vector or sequence items are pulled from, or the path of a file
+   whose forms are the items */
+struct lseq {
+    int kind;
+    lval* fn;
+    lval* src;
+    /* range from, to by step, without an end if open; take count in to */
+    long from;
+    long to;
+    long step;
+    int open;
 };
 
+/* lcells header size in words */
+#define LCELLS_HEADER ((int)(sizeof(lcells) / sizeof(void*)))
+
+/* envs up to LENV_INLINE symbols scan an inline array, larger ones
+   switch to an open addressing hash table */
+#define LENV_INLINE 4
+#define LENV_TABLE_MIN 16
+/* old table slots moved per insert while a resize is in progress */
+#define LENV_MIGRATE 4
+
+/* keys are interned symbol names; lookups search an env, then the
+   envs its lambda captured (lex), then the caller (par) and so on */
 struct lenv {
+    int refs;
     lenv* par;
+    lenv* lex;
     int count;
+    int cap;
     char** syms;
     lval** vals;
+
+    /* inline storage for small envs */
+    char* inl_syms[LENV_INLINE];
+    lval* inl_vals[LENV_INLINE];
+
+    /* table being migrated during incremental resize */
+    char** old_syms;
+    lval** old_vals;
+    int old_cap;
+    int old_pos;
+
+    /* index in the collector's env list, -1 if untracked (see gc.h) */
+    int gc_slot;
+};
+
+/* operators of the math, ordering, comparison and variable builtins */
+enum { LMATH_ADD, LMATH_SUB, LMATH_MUL, LMATH_DIV };
+enum { LORD_GT, LORD_LT, LORD_GE, LORD_LE };
+enum { LCMP_EQ, LCMP_NE };
+enum { LVAR_DEF, LVAR_PUT };
+
+/* private writable mapping of a loaded file, kept until the last
+   string read from it is freed */
+struct lmap {
+    int refs;
+    char* s;
+    long len;
+    long page;
+    /* pages before kept are released or hold strings */
+    long kept;
 };
 
+/* output buffer, flushed to f when it fills or on lout_flush; with no
+   f it grows to collect a string */
+typedef struct lout {
+    char* s;
+    long len;
+    long cap;
+    FILE* f;
+} lout;
+
+#define LOUT_CHUNK 8192
+
+/* reader cursor over len chars, which need no terminator; a file
+   reader refills s from f, keeping only the form being read; a mapped
+   reader reads map in place */
+typedef struct lreader {
+    char* s;
+    long len;
+    long pos;
+    FILE* f;
+    long cap;
+    lmap* map;
+} lreader;
+
+/* file read size */
+#define LREADER_CHUNK 65536
+
+/* true if there is a char at pos */
+#define LREADER_MORE(r) ((r)->pos < (r)->len || lreader_fill(r))
+/* next char, '\0' at the end */
+#define LREADER_PEEK(r) (LREADER_MORE(r) ? (r)->s[(r)->pos] : '\0')
+
+/* position in the items of a list, vector or sequence */
+typedef struct lsiter {
+    lval* v;
+    struct lsiter* src;
+    long i;
+    /* set once a range has stepped past the last long */
+    int done;
+    FILE* f;
+    lreader* r;
+} lsiter;
+
+/* lchar_class flags */
+#define LCHAR_SPACE 1
+#define LCHAR_SYM 2
+#define LCHAR_DIGIT 4
+#define LCHAR_ESCAPE 8
+
+extern unsigned char lchar_class[256];
+extern char* lval_str_escapable;
+
+/* interned "&" for varargs formals */
+extern char* lsym_amp;
+
+/* interned "if", which the vm compiles inline */
+extern char* lsym_if;
+
+/* number of envs binding an interned name, stored just before it */
+#define LSYM_BINDS(s) (((long*)(s))[-1])
+
+/* env builtins are registered in, the end of every lookup chain */
+extern lenv* lenv_global;
+
+/* set while a top level form is evaluated, from the repl or a file */
+extern int ltop_form;
+
+/* bumped when a local definition may shadow a captured variable */
+extern int lenv_epoch;
+
+lval* lval_new(int type);
 lval* lval_num(long x);
 lval* lval_err(char* fmt, ...);
+unsigned long lsym_hash(char* s, int n);
+lval* lsym_intern(char* s);
+lval* lsym_intern_n(char* s, int n);
 lval* lval_sym(char* s);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
+lval* lval_qexpr_cap(int n);
+lval* lval_written(lval* v);
+lval* lval_ref(lval* v);
 void lval_del(lval* v);
+lcells* lcells_new(int n);
+void lcells_del(lcells* b);
+void lval_own_cells(lval* v);
+void lval_reserve(lval* v, int front, int back);
 lval* lval_add(lval* v, lval* x);
-void lval_expr_print(lval* v, char open, char close);
+lout* lout_std(void);
+lout lout_string(void);
+lout lout_file(FILE* f);
+void lout_flush(lout* o);
+char* lout_take(lout* o);
+void lout_reserve(lout* o, long n);
+void lout_write(lout* o, char* s, long n);
+void lout_char(lout* o, char c);
+void lout_cstr(lout* o, char* s);
+void lout_num(lout* o, long x);
+void lout_dbl(lout* o, double x);
+void lval_write_expr(lout* o, lval* v, char open, char close);
+void lval_write(lout* o, lval* v);
 void lval_print(lval* v);
 void lval_println(lval* v);
 lval* lval_eval_sexpr(lenv* e, lval* v);
+int lenv_shadows(lenv* n, lenv* o);
 lval* lval_eval(lenv* e, lval* v);
 lval* lval_pop(lval* v, int i);
 lval* lval_take(lval* v, int i);
-lval* builtin_op(lenv* e, lval* a, char* op);
+lval* lval_slice(lval* v, int start, int end);
+lval* builtin_op(lenv* e, lval* a, int op);
+lval* lmath_fold(int op, lval** xs, int n);
+int lval_is_num(lval* v);
+lval* lval_big(lbig* b);
+lval* lval_dbl(double x);
+double lnum_dbl(lval* v);
+lval* lnum_op2(int op, lval* x, lval* y);
+lval* lnum_fold(int op, lval** xs, int n);
+int lnum_cmp(lval* x, lval* y);
+int lnum_ord(int op, lval* x, lval* y);
+int lnum_syntax(char* s, int n);
+int lmath_op(lbuiltin f);
 lval* builtin_head(lenv* e, lval* a);
 lval* builtin_tail(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
+lval* builtin_eval_expr(lval* a);
 lval* builtin_eval(lenv* e, lval* a);
 lval* builtin_join(lenv* e, lval* a);
+lval* lval_item(lenv* e, lval* l, int i);
+lval* lval_apply(lenv* e, lval* f, lval* a);
+lval* lval_args(lval* x, lval* y);
+lval* lval_range_err(char* func, long n, lval* l);
+lval* builtin_len(lenv* e, lval* a);
+lval* builtin_nth(lenv* e, lval* a);
+lval* builtin_last(lenv* e, lval* a);
+lval* builtin_take(lenv* e, lval* a);
+lval* builtin_drop(lenv* e, lval* a);
+lval* builtin_elem(lenv* e, lval* a);
+lval* builtin_map(lenv* e, lval* a);
+lval* builtin_filter(lenv* e, lval* a);
+lval* lval_foldl(lenv* e, char* func, lval* f, int op, lval* z, lval* l);
+lval* builtin_foldl(lenv* e, lval* a);
+lval* builtin_sum(lenv* e, lval* a);
+lval* builtin_product(lenv* e, lval* a);
+ltable* ltable_new(int cap);
+void ltable_del(ltable* t);
+ltable* ltable_copy(ltable* t);
+void ltable_rehash(ltable* t, int cap);
+int ltable_find(ltable* t, lval* k, unsigned long h);
+void ltable_put(ltable* t, lval* k, lval* v);
+int ltable_remove(ltable* t, lval* k);
+int ltable_oldest(ltable* t);
+lval* lval_map(void);
+lval* lval_map_pairs(lval* l);
+lval* builtin_map_new(lenv* e, lval* a);
+lval* builtin_map_get(lenv* e, lval* a);
+lval* builtin_map_put(lenv* e, lval* a);
+lval* builtin_map_del(lenv* e, lval* a);
+lval* builtin_map_keys(lenv* e, lval* a);
+lval* lval_vec_list(lval* l);
+lval* lvec_range_err(char* func, long n, lval* v);
+lval* builtin_vec(lenv* e, lval* a);
+lval* builtin_vec_nth(lenv* e, lval* a);
+lval* builtin_vec_len(lenv* e, lval* a);
+lval* builtin_vec_push(lenv* e, lval* a);
+lval* builtin_vec_set(lenv* e, lval* a);
+lval* builtin_vec_pop(lenv* e, lval* a);
+lval* builtin_vec_rest(lenv* e, lval* a);
+lval* builtin_vec_list(lenv* e, lval* a);
+lval* lval_seq(int kind, lval* fn, lval* src);
+void lseq_del(lseq* s);
+lseq* lseq_copy(lseq* s);
+int lval_is_seqable(lval* v);
+lsiter* lsiter_new(lval* v);
+void lsiter_del(lsiter* it);
+lval* lsiter_next(lenv* e, lsiter* it);
+lval* builtin_range(lenv* e, lval* a);
+lval* builtin_lazy_map(lenv* e, lval* a);
+lval* builtin_lazy_filter(lenv* e, lval* a);
+lval* builtin_lazy_take(lenv* e, lval* a);
+lval* builtin_realize(lenv* e, lval* a);
+lval* lval_memo(lval* fn, long max);
+void lmemo_del(lmemo* m);
+lval* lmemo_find(lval* f);
+lval* builtin_memo(lenv* e, lval* a);
+lval* builtin_memo_call(lenv* e, lval* a);
+lval* builtin_memo_stats(lenv* e, lval* a);
 lval* lval_join(lval* x, lval* y);
 lval* lval_fun(lbuiltin func);
 lval* lval_copy(lval* v);
+lval* lval_unshare(lval* v);
 lenv* lenv_new(void);
 void lenv_del(lenv* e);
+unsigned long lenv_hash(char* sym);
+int lenv_slot(char** syms, int cap, char* sym);
+int lenv_find(lenv* e, char* sym, int* old);
+void lenv_migrate(lenv* e, int n);
+void lenv_grow(lenv* e);
 lval* lenv_get(lenv* e, lval* k);
 void lenv_put(lenv* e, lval* k, lval* v);
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
 lval* builtin_mul(lenv* e, lval* a);
 lval* builtin_div(lenv* e, lval* a);
+char* lbuiltin_name(lbuiltin func);
+lbuiltin lbuiltin_find(char* name);
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* e);
 char* ltype_name(int t);
-lval* builtin_var(lenv* e, lval* a, char* func);
-lval* lval_lambda(lval* formals, lval* body);
+lval* builtin_var(lenv* e, lval* a, int var);
+lval* lval_lambda(lenv* e, lval* formals, lval* body);
 lval* builtin_lambda(lenv* e, lval* a);
+lval* builtin_fun(lenv* e, lval* a);
 lenv* lenv_copy(lenv* e);
 void lenv_def(lenv* e, lval* k, lval* v);
 lval* builtin_def(lenv* e, lval* a);
 lval* builtin_put(lenv* e, lval* a);
+lval* lval_bind(lenv* e, lval* f, lval* a);
 lval* lval_call(lenv* e, lval* f, lval* a);
 lval* builtin_gt(lenv* e, lval* a);
 lval* builtin_lt(lenv* e, lval* a);
 lval* builtin_ge(lenv* e, lval* a);
 lval* builtin_le(lenv* e, lval* a);
-lval* builtin_ord(lenv* e, lval* a, char* op);
+lval* builtin_ord(lenv* e, lval* a, int op);
+int lord_test(int op, long x, long y);
+int lord_op(lbuiltin f);
+int lenv_eq(lenv* x, lenv* y);
 int lval_eq(lval* x, lval* y);
-lval* builtin_cmp(lenv* e, lval* a, char* op);
+unsigned long lval_hash(lval* v);
+lval* builtin_cmp(lenv* e, lval* a, int op);
 lval* builtin_eq(lenv* e, lval* a);
 lval* builtin_ne(lenv* e, lval* a);
+lval* builtin_if_expr(lval* a);
 lval* builtin_if(lenv* e, lval* a);
 lval* lval_str(char* s);
 lval* builtin_load(lenv* e, lval* a);
+lval* builtin_load_seq(lenv* e, lval* a);
+lval* builtin_serialize(lenv* e, lval* a);
+lval* builtin_deserialize(lenv* e, lval* a);
+lval* lval_load(lenv* e, FILE* f);
 lval* builtin_print(lenv* e, lval* a);
+lval* builtin_show(lenv* e, lval* a);
 lval* builtin_error(lenv* e, lval* a);
-lval* lval_read_expr(char* s, int* i, char end);
-lval* lval_read(char* s, int* i);
-lval* lval_read_sym(char* s, int* i);
+void lchar_init(void);
+lreader lreader_new(char* s, long len);
+lreader lreader_file(FILE* f);
+lreader lreader_map(lmap* m);
+lmap* lmap_open(FILE* f);
+void lmap_release(lmap* m, long pos);
+void lmap_del(lmap* m);
+void lreader_del(lreader* r);
+int lreader_fill(lreader* r);
+lval* lreader_next(lreader* r);
+void lreader_skip(lreader* r);
+lval* lval_read_expr(lreader* r, char end);
+lval* lval_read(lreader* r);
+lval* lval_read_sym(lreader* r);
 char lval_str_unescape(char x);
 char* lval_str_escape(char x);
-lval* lval_read_str(char* s, int* i);
-void lval_print_str(lval* v);
-lval* lval_read(char* s, int* i);
\ No newline at end of file
+lval* lval_read_str(lreader* r);
+void lval_write_str(lout* o, lval* v);
+lval* builtin_mem_stats(lenv* e, lval* a);
+lval* builtin_gc(lenv* e, lval* a);
+lval* builtin_gc_stats(lenv* e, lval* a);
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser-util.h"
+#include "vector.h"
+
+lvnode* lvnode_new(int leaf) {
+    lvnode* n = calloc(1, sizeof(lvnode));
+    n->refs = 1;
+    n->leaf = leaf;
+    return n;
+}
+
+/* n with the same children, referenced again */
+lvnode* lvnode_copy(lvnode* n) {
+    lvnode* x = malloc(sizeof(lvnode));
+    memcpy(x, n, sizeof(lvnode));
+    x->refs = 1;
+    for (int i = 0; i < LVEC_WIDTH; i++) {
+        if (!x->slots[i]) { continue; }
+        if (x->leaf) { lval_ref(x->slots[i]); } else { ((lvnode*)x->slots[i])->refs++; }
+    }
+    return x;
+}
+
+void lvnode_del(lvnode* n) {
+    if (--n->refs > 0) { return; }
+    for (int i = 0; i < LVEC_WIDTH; i++) {
+        if (!n->slots[i]) { continue; }
+        if (n->leaf) { lval_del(n->slots[i]); } else { lvnode_del(n->slots[i]); }
+    }
+    free(n);
+}
+
+/* empty vector type lval */
+lval* lval_vec(void) {
+    lval* v = lval_new(LVAL_VEC);
+    v->root = NULL;
+    v->tail = NULL;
+    v->lo = 0;
+    v->end = 0;
+    v->shift = LVEC_BITS;
+    return v;
+}
+
+/* index of the first item in the tail */
+static int lvec_tailoff(int end) {
+    return end ? ((end - 1) >> LVEC_BITS) << LVEC_BITS : 0;
+}
+
+/* n if we hold the only reference, otherwise a private copy */
+static lvnode* lvnode_own(lvnode* n) {
+    if (n->refs == 1) { return n; }
+    lvnode* x = lvnode_copy(n);
+    lvnode_del(n);
+    return x;
+}
+
+/* v if we hold the only reference, otherwise a new vector sharing its
+   nodes */
+static lval* lvec_own(lval* v) {
+    if (v->refs == 1) { return v; }
+    lval* x = lval_new(LVAL_VEC);
+    x->root = v->root;
+    x->tail = v->tail;
+    x->lo = v->lo;
+    x->end = v->end;
+    x->shift = v->shift;
+    if (x->root) { x->root->refs++; }
+    if (x->tail) { x->tail->refs++; }
+    lval_del(v);
+    return x;
+}
+
+/* item i of v, not a new reference */
+lval* lvec_nth(lval* v, int i) {
+    i += v->lo;
+    if (i >= lvec_tailoff(v->end)) { return v->tail->slots[i & LVEC_MASK]; }
+    lvnode* n = v->root;
+    for (int level = v->shift; level > 0; level -= LVEC_BITS) {
+        n = n->slots[(i >> level) & LVEC_MASK];
+    }
+    return n->slots[i & LVEC_MASK];
+}
+
+/* leaf under a chain of new branches down from level */
+static lvnode* lvec_path(int level, lvnode* leaf) {
+    if (level == 0) { return leaf; }
+    lvnode* n = lvnode_new(0);
+    n->slots[0] = lvec_path(level - LVEC_BITS, leaf);
+    return n;
+}
+
+/* node with the full tail leaf hung on the path to index end - 1,
+   taking node */
+static lvnode* lvec_push_leaf(int end, int level, lvnode* node, lvnode* leaf) {
+    lvnode* n = lvnode_own(node);
+    int i = ((end - 1) >> level) & LVEC_MASK;
+    if (level == LVEC_BITS) {
+        n->slots[i] = leaf;
+    } else if (n->slots[i]) {
+        n->slots[i] = lvec_push_leaf(end, level - LVEC_BITS, n->slots[i], leaf);
+    } else {
+        n->slots[i] = lvec_path(level - LVEC_BITS, leaf);
+    }
+    return n;
+}
+
+/* v with x added at the end, taking both */
+lval* lvec_push(lval* v, lval* x) {
+    v = lvec_own(v);
+    int end = v->end;
+    v->end++;
+
+    /* room in the tail */
+    if (v->tail && end - lvec_tailoff(end) < LVEC_WIDTH) {
+        v->tail = lvnode_own(v->tail);
+        v->tail->slots[end & LVEC_MASK] = x;
+        return v;
+    }
+
+    /* the full tail moves into the trie, under a new root once the
+       old one is full */
+    if (v->tail) {
+        lvnode* leaf = v->tail;
+        if (!v->root) {
+            v->root = lvec_path(v->shift, leaf);
+        } else if ((end >> LVEC_BITS) > (1 << v->shift)) {
+            lvnode* root = lvnode_new(0);
+            root->slots[0] = v->root;
+            root->slots[1] = lvec_path(v->shift, leaf);
+            v->root = root;
+            v->shift += LVEC_BITS;
+        } else {
+            v->root = lvec_push_leaf(end, v->shift, v->root, leaf);
+        }
+    }
+    v->tail = lvnode_new(1);
+    v->tail->slots[0] = x;
+    return v;
+}
+
+/* node with x in place of item i, taking node and x */
+static lvnode* lvec_set_node(int level, lvnode* node, int i, lval* x) {
+    lvnode* n = lvnode_own(node);
+    int j = (i >> level) & LVEC_MASK;
+    if (level == 0) {
+        lval_del(n->slots[j]);
+        n->slots[j] = x;
+    } else {
+        n->slots[j] = lvec_set_node(level - LVEC_BITS, n->slots[j], i, x);
+    }
+    return n;
+}
+
+/* v with item i replaced by x, taking both */
+lval* lvec_set(lval* v, int i, lval* x) {
+    v = lvec_own(v);
+    i += v->lo;
+    if (i >= lvec_tailoff(v->end)) {
+        v->tail = lvec_set_node(0, v->tail, i, x);
+    } else {
+        v->root = lvec_set_node(v->shift, v->root, i, x);
+    }
+    return v;
+}
+
+/* node without the leaf after index end - 2, taking node; NULL if
+   nothing is left under it */
+static lvnode* lvec_pop_leaf(int end, int level, lvnode* node) {
+    lvnode* n = lvnode_own(node);
+    int i = ((end - 2) >> level) & LVEC_MASK;
+    if (level > LVEC_BITS) {
+        n->slots[i] = lvec_pop_leaf(end, level - LVEC_BITS, n->slots[i]);
+    } else {
+        lvnode_del(n->slots[i]);
+        n->slots[i] = NULL;
+    }
+    /* later slots are empty, so is this node */
+    if (i == 0 && !n->slots[0]) {
+        lvnode_del(n);
+        return NULL;
+    }
+    return n;
+}
+
+/* v without its last item, taking v, which is not empty */
+lval* lvec_pop(lval* v) {
+    if (v->end - v->lo == 1) {
+        lval_del(v);
+        return lval_vec();
+    }
+
+    v = lvec_own(v);
+    int end = v->end;
+    v->end--;
+
+    /* more than one item in the tail */
+    if (end - lvec_tailoff(end) > 1) {
+        v->tail = lvnode_own(v->tail);
+        lval_del(v->tail->slots[(end - 1) & LVEC_MASK]);
+        v->tail->slots[(end - 1) & LVEC_MASK] = NULL;
+        return v;
+    }
+
+    /* the last leaf of the trie becomes the tail */
+    lvnode* n = v->root;
+    for (int level = v->shift; level > 0; level -= LVEC_BITS) {
+        n = n->slots[((end - 2) >> level) & LVEC_MASK];
+    }
+    n->refs++;
+    lvnode_del(v->tail);
+    v->tail = n;
+
+    lvnode* root = lvec_pop_leaf(end, v->shift, v->root);
+    v->root = root;
+    /* drop a root with a single child */
+    if (root && v->shift > LVEC_BITS && !root->slots[1]) {
+        v->root = root->slots[0];
+        v->root->refs++;
+        lvnode_del(root);
+        v->shift -= LVEC_BITS;
+    }
+    if (!v->root) { v->shift = LVEC_BITS; }
+    return v;
+}
+
+/* v without its first item, taking v, which is not empty. the trie is
+   kept as it is, the item goes with the last version holding it */
+lval* lvec_rest(lval* v) {
+    if (v->end - v->lo == 1) {
+        lval_del(v);
+        return lval_vec();
+    }
+    v = lvec_own(v);
+    v->lo++;
+    return v;
+}
\ No newline at end of file
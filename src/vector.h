@@ -0,0 +1,29 @@
+/* persistent vectors, a 32-way trie of the items with the last 1 to 32
+   in a separate tail leaf so most pushes only touch the tail
+
+   updates copy the path to the item they change and share every other
+   node with the old version, so nth, push, set and pop are O(log32 n)
+   and old versions stay cheap to keep. nodes nothing else holds are
+   changed in place instead, as are vectors. items [lo, end) of the
+   trie are the vector, rest just moves lo. nodes are refcounted with
+   unused slots NULL, a leaf holds lvals, a branch holds nodes */
+
+#define LVEC_BITS 5
+#define LVEC_WIDTH (1 << LVEC_BITS)
+#define LVEC_MASK (LVEC_WIDTH - 1)
+
+struct lvnode {
+    int refs;
+    int leaf;
+    void* slots[LVEC_WIDTH];
+};
+
+lvnode* lvnode_new(int leaf);
+lvnode* lvnode_copy(lvnode* n);
+void lvnode_del(lvnode* n);
+lval* lval_vec(void);
+lval* lvec_nth(lval* v, int i);
+lval* lvec_push(lval* v, lval* x);
+lval* lvec_set(lval* v, int i, lval* x);
+lval* lvec_pop(lval* v);
+lval* lvec_rest(lval* v);
\ No newline at end of file
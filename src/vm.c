@@ -0,0 +1,494 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser-util.h"
+#include "vm.h"
+#include "opt.h"
+
+int lvm_enabled = 1;
+
+/* value stack, shared by nested vm runs */
+lval** lvm_stack = NULL;
+int lvm_sp = 0;
+int lvm_cap = 0;
+
+/* frames of running compiled lambdas */
+lframe* lvm_frames = NULL;
+int lvm_nframes = 0;
+int lvm_fcap = 0;
+
+lcode* lcode_new(void) {
+    lcode* c = malloc(sizeof(lcode));
+    c->refs = 1;
+    c->ops = NULL;
+    c->count = 0;
+    c->cap = 0;
+    c->consts = NULL;
+    c->nconsts = 0;
+    c->depths = NULL;
+    c->slots = NULL;
+    c->ncaptured = 0;
+    c->epoch = lenv_epoch;
+    c->lex = NULL;
+    c->formals = NULL;
+    c->nformals = 0;
+    return c;
+}
+
+void lcode_del(lcode* c) {
+    if (--c->refs > 0) { return; }
+    for (int i = 0; i < c->nconsts; i++) {
+        lval_del(c->consts[i]);
+    }
+    free(c->consts);
+    free(c->depths);
+    free(c->slots);
+    free(c->formals);
+    free(c->ops);
+    free(c);
+}
+
+void lcode_emit(lcode* c, int op) {
+    if (c->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->ops = realloc(c->ops, sizeof(int) * c->cap);
+    }
+    c->ops[c->count++] = op;
+}
+
+/* index of x in the constant pool, adding it if needed */
+int lcode_const(lcode* c, lval* x) {
+    for (int i = 0; i < c->nconsts; i++) {
+        if (c->consts[i] == x) { return i; }
+    }
+    c->nconsts++;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->nconsts);
+    c->depths = realloc(c->depths, sizeof(int) * c->nconsts);
+    c->slots = realloc(c->slots, sizeof(int) * c->nconsts);
+    c->consts[c->nconsts-1] = lval_ref(x);
+    c->depths[c->nconsts-1] = 0;
+    c->slots[c->nconsts-1] = 0;
+    return c->nconsts-1;
+}
+
+/* code evaluating x, returning from the frame if tail is set */
+void lcode_expr(lcode* c, lval* x, int tail) {
+    switch (x->type) {
+        case LVAL_SYM: {
+            int k = lcode_const(c, x);
+
+            /* formals bind in order into the env's inline slots */
+            int formal = -1;
+            for (int i = 0; i < c->nformals; i++) {
+                if (c->formals[i] == x->sym) { formal = i; break; }
+            }
+
+            if (formal >= 0) {
+                c->depths[k] = 0;
+                if (formal < LENV_INLINE) {
+                    lcode_emit(c, LOP_LOCAL);
+                    lcode_emit(c, formal);
+                } else {
+                    lcode_emit(c, LOP_NAME);
+                }
+            } else {
+                int slot = 0;
+                int depth = lcode_resolve(c->lex, x->sym, &slot);
+                if (c->depths[k] == 0 && depth > 0) { c->ncaptured++; }
+                c->depths[k] = depth;
+                c->slots[k] = slot;
+                if (depth > 0) {
+                    lcode_emit(c, LOP_CAPTURED);
+                    lcode_emit(c, depth);
+                    lcode_emit(c, slot);
+                } else {
+                    lcode_emit(c, LOP_NAME);
+                }
+            }
+            lcode_emit(c, k);
+        }
+        break;
+        case LVAL_SEXPR: lcode_sexpr(c, x, tail); return;
+        /* the expression it was folded from runs when it does not hold */
+        case LVAL_FOLD: {
+            lcode_emit(c, LOP_FOLD);
+            lcode_emit(c, lcode_const(c, x));
+            int patch = c->count;
+            lcode_emit(c, 0);
+            if (x->expr->type == LVAL_QEXPR) {
+                lcode_sexpr(c, x->expr, tail);
+            } else {
+                lcode_expr(c, x->expr, tail);
+            }
+            c->ops[patch] = c->count;
+        }
+        break;
+        default:
+            lcode_emit(c, LOP_CONST);
+            lcode_emit(c, lcode_const(c, x));
+        break;
+    }
+    if (tail) { lcode_emit(c, LOP_RET); }
+}
+
+/* code evaluating the items of x as an s-expression */
+void lcode_sexpr(lcode* c, lval* x, int tail) {
+    /* empty evaluates to itself */
+    if (x->count == 0) {
+        lval* empty = lval_sexpr();
+        lcode_emit(c, LOP_CONST);
+        lcode_emit(c, lcode_const(c, empty));
+        lval_del(empty);
+        if (tail) { lcode_emit(c, LOP_RET); }
+        return;
+    }
+
+    /* single evaluates to its item */
+    if (x->count == 1) {
+        lcode_expr(c, x->cell[0], tail);
+        return;
+    }
+
+    /* (if cond {then} {else}) branches inline when if is the builtin */
+    if (x->count == 4 && x->cell[0]->type == LVAL_SYM
+        && x->cell[0]->sym == lsym_if
+        && x->cell[2]->type == LVAL_QEXPR && x->cell[3]->type == LVAL_QEXPR) {
+        lcode_expr(c, x->cell[0], 0);
+        lcode_expr(c, x->cell[1], 0);
+        lcode_emit(c, LOP_IF);
+        int patch = c->count;
+        lcode_emit(c, 0);
+        lcode_emit(c, 0);
+
+        lcode_sexpr(c, x->cell[2], tail);
+        int then_end = -1;
+        if (!tail) { lcode_emit(c, LOP_JUMP); then_end = c->count; lcode_emit(c, 0); }
+
+        c->ops[patch] = c->count;
+        lcode_sexpr(c, x->cell[3], tail);
+        int else_end = -1;
+        if (!tail) { lcode_emit(c, LOP_JUMP); else_end = c->count; lcode_emit(c, 0); }
+
+        /* anything unexpected, call whatever if is bound to */
+        c->ops[patch+1] = c->count;
+        lcode_expr(c, x->cell[2], 0);
+        lcode_expr(c, x->cell[3], 0);
+        lcode_emit(c, tail ? LOP_TAILCALL : LOP_CALL);
+        lcode_emit(c, 4);
+        if (tail) {
+            lcode_emit(c, LOP_RET);
+        } else {
+            c->ops[then_end] = c->count;
+            c->ops[else_end] = c->count;
+        }
+        return;
+    }
+
+    for (int i = 0; i < x->count; i++) {
+        lcode_expr(c, x->cell[i], 0);
+    }
+    lcode_emit(c, tail ? LOP_TAILCALL : LOP_CALL);
+    lcode_emit(c, x->count);
+    if (tail) { lcode_emit(c, LOP_RET); }
+}
+
+/* depth of sym in the captured envs from lex on, setting its slot;
+   -1 if it is not bound there (or not at a stable slot) */
+int lcode_resolve(lenv* lex, char* sym, int* slot) {
+    int depth = 1;
+    for (lenv* l = lex; l; l = l->lex, depth++) {
+        int old;
+        int i = lenv_find(l, sym, &old);
+        if (i >= 0) {
+            if (old) { return -1; }
+            *slot = i;
+            return depth;
+        }
+    }
+    return -1;
+}
+
+/* true if symbols in c resolve the same way for a lambda capturing lex */
+int lcode_valid(lcode* c, lenv* lex) {
+    if (!lex) { return c->ncaptured == 0; }
+    if (c->ncaptured && c->epoch != lenv_epoch) { return 0; }
+
+    for (int k = 0; k < c->nconsts; k++) {
+        if (c->consts[k]->type != LVAL_SYM || c->depths[k] == 0) { continue; }
+        int slot = 0;
+        int depth = lcode_resolve(lex, c->consts[k]->sym, &slot);
+        if (depth != c->depths[k]) { return 0; }
+        if (depth > 0 && slot != c->slots[k]) { return 0; }
+    }
+    return 1;
+}
+
+/* compile body for formals of a lambda capturing lex, caching the code
+   on the body */
+void lcode_compile(lenv* lex, lval* formals, lval* body) {
+    /* formal names, '&' takes no slot */
+    int n = 0;
+    char** names = malloc(sizeof(char*) * (formals->count + 1));
+    for (int i = 0; i < formals->count; i++) {
+        if (formals->cell[i]->sym != lsym_amp) { names[n++] = formals->cell[i]->sym; }
+    }
+
+    /* already compiled for the same formals and scope */
+    if (body->code && body->code->nformals == n
+        && memcmp(body->code->formals, names, sizeof(char*) * n) == 0
+        && lcode_valid(body->code, lex)) {
+        free(names);
+        return;
+    }
+
+    lcode* c = lcode_new();
+    c->formals = names;
+    c->nformals = n;
+    c->lex = lex;
+    lcode_sexpr(c, body, 1);
+    c->lex = NULL;
+
+    if (body->code) { lcode_del(body->code); }
+    body->code = c;
+}
+
+void lvm_push(lval* x) {
+    if (lvm_sp == lvm_cap) {
+        lvm_cap = lvm_cap ? lvm_cap * 2 : 256;
+        lvm_stack = realloc(lvm_stack, sizeof(lval*) * lvm_cap);
+    }
+    lvm_stack[lvm_sp++] = x;
+}
+
+/* new frame running the body of lambda f, which it takes over */
+void lvm_enter(lval* f) {
+    if (lvm_nframes == lvm_fcap) {
+        lvm_fcap = lvm_fcap ? lvm_fcap * 2 : 64;
+        lvm_frames = realloc(lvm_frames, sizeof(lframe) * lvm_fcap);
+    }
+    lframe* fr = &lvm_frames[lvm_nframes++];
+    fr->code = f->body->code;
+    fr->code->refs++;
+    fr->pc = 0;
+    fr->fn = f;
+    fr->kept = NULL;
+    fr->base = lvm_sp;
+}
+
+void lvm_leave(void) {
+    lframe* fr = &lvm_frames[--lvm_nframes];
+    lval_del(fr->fn);
+    lcode_del(fr->code);
+    if (fr->kept) { lval_del(fr->kept); }
+}
+
+/* true if all n values are numbers */
+int lvm_nums(lval** v, int n) {
+    for (int i = 0; i < n; i++) {
+        if (v[i]->type != LVAL_NUM) { return 0; }
+    }
+    return 1;
+}
+
+/* evaluate (fn args...) from the top n stack values as lval_eval would;
+   a compiled lambda gets a frame (replacing the current one for a tail
+   call), anything else leaves its result on the stack */
+void lvm_apply(int n, int tail) {
+    lframe* fr = &lvm_frames[lvm_nframes-1];
+    lenv* e = fr->fn->env;
+    lval** v = &lvm_stack[lvm_sp - n];
+
+    /* error check, first one wins */
+    for (int i = 0; i < n; i++) {
+        if (v[i]->type == LVAL_ERR) {
+            lval* err = lval_ref(v[i]);
+            for (int j = 0; j < n; j++) { lval_del(v[j]); }
+            lvm_sp -= n;
+            lvm_push(err);
+            return;
+        }
+    }
+
+    /* ensure func as first element */
+    lval* f = v[0];
+    if (f->type != LVAL_FUN) {
+        lval* err = lval_err(
+            "S-Expression starts with incorrect type. "
+            "Got %s, Expected %s.",
+            ltype_name(f->type), ltype_name(LVAL_FUN));
+        for (int j = 0; j < n; j++) { lval_del(v[j]); }
+        lvm_sp -= n;
+        lvm_push(err);
+        return;
+    }
+
+    /* numeric and comparison builtins work straight off the stack */
+    if (f->builtin) {
+        lval* r = NULL;
+        int op;
+        if (n == 3 && (f->builtin == builtin_eq || f->builtin == builtin_ne)) {
+            int eq = lval_eq(v[1], v[2]);
+            r = lval_num(f->builtin == builtin_eq ? eq : !eq);
+        } else if ((op = lmath_op(f->builtin)) >= 0 && lvm_nums(&v[1], n-1)) {
+            r = lmath_fold(op, &v[1], n-1);
+        } else if (n == 3 && (op = lord_op(f->builtin)) >= 0 && lvm_nums(&v[1], 2)) {
+            r = lval_num(lord_test(op, v[1]->num, v[2]->num));
+        }
+        if (r) {
+            for (int j = 0; j < n; j++) { lval_del(v[j]); }
+            lvm_sp -= n;
+            lvm_push(r);
+            return;
+        }
+    }
+
+    /* args move off the stack into a list */
+    lval* a = lval_sexpr();
+    lval_reserve(a, 0, n-1);
+    memcpy(a->cell, &v[1], sizeof(lval*) * (n-1));
+    a->count = n-1;
+    a->buf->hi += n-1;
+    lvm_sp -= n;
+
+    if (f->builtin) {
+        lvm_push(f->builtin(e, a));
+        lval_del(f);
+        return;
+    }
+
+    /* error or partially applied function */
+    f = lval_unshare(f);
+    lval* r = lval_bind(e, f, a);
+    if (r) {
+        lval_del(f);
+        lvm_push(r);
+        return;
+    }
+
+    /* body was never compiled, tree walk it */
+    if (!f->body->code) {
+        f->env->par = e;
+        lvm_push(builtin_eval(f->env, lval_add(lval_sexpr(), lval_ref(f->body))));
+        lval_del(f);
+        return;
+    }
+
+    if (tail && lvm_sp == fr->base) {
+        /* drop a frame the new one wholly shadows (see lval_eval),
+           otherwise keep it alive on the env chain */
+        if (lenv_shadows(f->env, e)) {
+            f->env->par = e->par;
+            lval_del(fr->fn);
+        } else {
+            f->env->par = e;
+            if (!fr->kept) { fr->kept = lval_sexpr(); }
+            lval_add(fr->kept, fr->fn);
+        }
+        fr->fn = f;
+        lcode_del(fr->code);
+        fr->code = f->body->code;
+        fr->code->refs++;
+        fr->pc = 0;
+        return;
+    }
+
+    f->env->par = e;
+    lvm_enter(f);
+}
+
+/* run compiled lambda f, already bound and given its env parent */
+lval* lvm_call(lval* f) {
+    int bottom = lvm_nframes;
+    lvm_enter(f);
+
+    while (1) {
+        lframe* fr = &lvm_frames[lvm_nframes-1];
+        int* ops = fr->code->ops;
+        lval** k = fr->code->consts;
+        lenv* e = fr->fn->env;
+
+        switch (ops[fr->pc++]) {
+            case LOP_CONST:
+                lvm_push(lval_ref(k[ops[fr->pc++]]));
+            break;
+
+            case LOP_FOLD: {
+                lval* fold = k[ops[fr->pc++]];
+                int to = ops[fr->pc++];
+                if (lfold_valid(fold)) {
+                    lvm_push(lval_ref(fold->value));
+                    fr->pc = to;
+                }
+            }
+            break;
+
+            case LOP_LOCAL: {
+                int i = ops[fr->pc++];
+                lval* sym = k[ops[fr->pc++]];
+                /* the slot is only trusted while it still holds the formal */
+                if (e->syms == e->inl_syms && e->syms[i] == sym->sym) {
+                    lvm_push(lval_ref(e->vals[i]));
+                } else {
+                    lvm_push(lenv_get(e, sym));
+                }
+            }
+            break;
+
+            case LOP_CAPTURED: {
+                int d = ops[fr->pc++];
+                int i = ops[fr->pc++];
+                lval* sym = k[ops[fr->pc++]];
+                lenv* l = e;
+                while (d-- && l) { l = l->lex; }
+                /* trusted while no local definition could shadow it */
+                if (l && fr->code->epoch == lenv_epoch && i < l->cap
+                    && l->syms[i] == sym->sym) {
+                    lvm_push(lval_ref(l->vals[i]));
+                } else {
+                    lvm_push(lenv_get(e, sym));
+                }
+            }
+            break;
+
+            case LOP_NAME:
+                lvm_push(lenv_get(e, k[ops[fr->pc++]]));
+            break;
+
+            case LOP_CALL:
+            case LOP_TAILCALL: {
+                int tail = ops[fr->pc-1] == LOP_TAILCALL;
+                lvm_apply(ops[fr->pc++], tail);
+            }
+            break;
+
+            case LOP_IF: {
+                int els = ops[fr->pc++];
+                int fallback = ops[fr->pc++];
+                lval* fn = lvm_stack[lvm_sp-2];
+                lval* cond = lvm_stack[lvm_sp-1];
+                if (fn->type == LVAL_FUN && fn->builtin == builtin_if
+                    && cond->type == LVAL_NUM) {
+                    if (!cond->num) { fr->pc = els; }
+                    lval_del(fn);
+                    lval_del(cond);
+                    lvm_sp -= 2;
+                } else {
+                    fr->pc = fallback;
+                }
+            }
+            break;
+
+            case LOP_JUMP:
+                fr->pc = ops[fr->pc];
+            break;
+
+            case LOP_RET: {
+                lval* r = lvm_stack[--lvm_sp];
+                lvm_leave();
+                if (lvm_nframes == bottom) { return r; }
+                lvm_push(r);
+            }
+            break;
+        }
+    }
+}
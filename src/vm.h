@@ -0,0 +1,79 @@
+/* bytecode compiler and stack vm for lambda bodies
+
+   a lambda's body is compiled once, when the lambda is created, and the
+   code is cached on the body q-expr. symbols resolve at that point to a
+   formal's slot, a (depth, slot) in the captured envs, or a name lookup.
+   calls between compiled lambdas run on the vm's own frame stack;
+   anything else (builtins, eval, bodies that were never compiled) goes
+   through the tree walker in lval_eval */
+
+enum {
+    LOP_CONST,    /* k: push consts[k] */
+    LOP_FOLD,     /* k to: push the value of fold consts[k] and jump, while it holds */
+    LOP_LOCAL,    /* i k: push slot i of the frame env, if it holds consts[k] */
+    LOP_CAPTURED, /* d i k: as LOP_LOCAL, d captured envs out */
+    LOP_NAME,     /* k: push lookup of symbol consts[k] */
+    LOP_CALL,     /* n: evaluate (fn args...) from the top n stack values */
+    LOP_TAILCALL, /* n: as LOP_CALL, replacing the current frame */
+    LOP_IF,       /* else fallback: branch on the [if cond] pair on the stack */
+    LOP_JUMP,     /* to */
+    LOP_RET       /* return the top of the stack */
+};
+
+struct lcode {
+    /* held by the body and by frames running it */
+    int refs;
+
+    int* ops;
+    int count;
+    int cap;
+
+    /* constants and symbols referenced by ops */
+    lval** consts;
+    int nconsts;
+
+    /* how each symbol const resolved: depth in the captured envs and
+       slot, 0 for formals, -1 for name lookup */
+    int* depths;
+    int* slots;
+    int ncaptured;
+    /* lenv_epoch when resolved */
+    int epoch;
+    /* captured env while compiling */
+    lenv* lex;
+
+    /* formals the slots were assigned for */
+    char** formals;
+    int nformals;
+};
+
+/* frame of a running compiled lambda */
+typedef struct lframe {
+    lcode* code;
+    int pc;
+    /* lambda owning the env the body runs in */
+    lval* fn;
+    /* owners of earlier frames still on the env chain after tail calls */
+    lval* kept;
+    /* stack index where this frame's values start */
+    int base;
+} lframe;
+
+/* compile lambda bodies and run them on the vm, otherwise tree walk */
+extern int lvm_enabled;
+
+lcode* lcode_new(void);
+void lcode_del(lcode* c);
+void lcode_emit(lcode* c, int op);
+int lcode_const(lcode* c, lval* x);
+void lcode_expr(lcode* c, lval* x, int tail);
+void lcode_sexpr(lcode* c, lval* x, int tail);
+int lcode_resolve(lenv* lex, char* sym, int* slot);
+int lcode_valid(lcode* c, lenv* lex);
+void lcode_compile(lenv* lex, lval* formals, lval* body);
+void lvm_push(lval* x);
+void lvm_enter(lval* f);
+void lvm_leave(void);
+int lvm_nums(lval** v, int n);
+void lvm_apply(int n, int tail);
+lval* lvm_call(lval* f);